@@ -0,0 +1,719 @@
+#include "dwarf.h"
+#include "elf.h"
+#include "darray.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ERROR(STR, ...) do { printf("Error on line %d file %s: \"" STR "\"\n", __LINE__, __FILE__, ##__VA_ARGS__); exit(1); } while(0)
+
+enum {
+	DW_LNS_copy = 1,
+	DW_LNS_advance_pc = 2,
+	DW_LNS_advance_line = 3,
+	DW_LNS_set_file = 4,
+	DW_LNS_set_column = 5,
+	DW_LNS_negate_stmt = 6,
+	DW_LNS_set_basic_block = 7,
+	DW_LNS_const_add_pc = 8,
+	DW_LNS_fixed_advance_pc = 9,
+	DW_LNS_set_prologue_end = 10,
+	DW_LNS_set_epilogue_begin = 11,
+	DW_LNS_set_isa = 12,
+};
+
+enum {
+	DW_CFA_nop = 0x00,
+	DW_CFA_advance_loc1 = 0x02,
+	DW_CFA_advance_loc2 = 0x03,
+	DW_CFA_advance_loc4 = 0x04,
+	DW_CFA_restore_extended = 0x06,
+	DW_CFA_undefined = 0x07,
+	DW_CFA_same_value = 0x08,
+	DW_CFA_register = 0x09,
+	DW_CFA_remember_state = 0x0a,
+	DW_CFA_restore_state = 0x0b,
+	DW_CFA_def_cfa = 0x0c,
+	DW_CFA_def_cfa_register = 0x0d,
+	DW_CFA_def_cfa_offset = 0x0e,
+	DW_CFA_offset_extended_sf = 0x11,
+	DW_CFA_advance_loc = 0x40,
+	DW_CFA_offset = 0x80,
+	DW_CFA_restore = 0xc0,
+};
+
+enum {
+	DW_EH_PE_absptr = 0x00,
+	DW_EH_PE_udata4 = 0x03,
+	DW_EH_PE_sdata4 = 0x0b,
+	DW_EH_PE_pcrel = 0x10,
+	DW_EH_PE_indirect = 0x80,
+	DW_EH_PE_omit = 0xff,
+};
+
+enum {
+	DW_LNE_end_sequence = 1,
+	DW_LNE_set_address = 2,
+	DW_LNE_set_discriminator = 4,
+};
+
+// Same line program parameters as gas.
+#define LINE_BASE (-5)
+#define LINE_RANGE 14
+#define OPCODE_BASE 13
+
+static const uint8_t standard_opcode_lengths[OPCODE_BASE - 1] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+
+static size_t dir_size, dir_cap;
+static const char **dirs;
+
+// Indexed by file number, file 0 is only used by DWARF 5 and left out.
+static size_t file_size, file_cap;
+static struct file {
+	const char *name;
+	int dir;
+} *files;
+
+// Each row is a label at the address it describes, so that the table
+// follows functions that are folded or moved around before it is written.
+static size_t row_size, row_cap;
+static struct row {
+	char *label;
+	int section;
+	uint64_t address;
+	struct loc loc;
+	int order;
+} *rows;
+
+// The directory of file 0, used for relative names without one.
+static const char *comp_dir = NULL;
+
+// A .loc applies to the next instruction.
+static int has_pending = 0;
+static struct loc pending;
+
+static int find_dir(const char *dir) {
+	for (unsigned i = 0; i < dir_size; i++)
+		if (strcmp(dirs[i], dir) == 0)
+			return i + 1;
+
+	ADD_ELEMENT(dir_size, dir_cap, dirs) = strdup(dir);
+	return dir_size;
+}
+
+void dwarf_file(int number, const char *dir, const char *name) {
+	if (number == 0)
+		comp_dir = dir ? strdup(dir) : NULL;
+	if (number <= 0)
+		return;
+
+	while ((int)file_size <= number)
+		ADD_ELEMENT(file_size, file_cap, files) = (struct file) { 0 };
+
+	// Paths are split into a directory and a name, as in gas.
+	const char *slash = strrchr(name, '/');
+	if (slash) {
+		char *path_dir = strndup(name, slash == name ? 1 : slash - name);
+		files[number].dir = find_dir(path_dir);
+		free(path_dir);
+		name = slash + 1;
+	} else if (dir || comp_dir) {
+		files[number].dir = find_dir(dir ? dir : comp_dir);
+	} else {
+		files[number].dir = 0;
+	}
+	files[number].name = strdup(name);
+}
+
+static void add_row(struct loc *loc) {
+	char buffer[32];
+	sprintf(buffer, ".L.loc.%lu", row_size);
+	elf_symbol_set_here(buffer, 0);
+
+	struct row *row = &ADD_ELEMENT(row_size, row_cap, rows);
+	*row = (struct row) { .label = strdup(buffer), .loc = *loc, .order = row_size - 1 };
+}
+
+void dwarf_loc(const struct loc *loc) {
+	if (loc->file <= 0 || loc->file >= (int)file_size || !files[loc->file].name)
+		ERROR("Unknown file %d in .loc", loc->file);
+
+	if (has_pending)
+		add_row(&pending);
+	pending = *loc;
+	has_pending = 1;
+}
+
+void dwarf_instruction(void) {
+	if (!has_pending)
+		return;
+	add_row(&pending);
+	has_pending = 0;
+}
+
+static int compare_rows(const void *a, const void *b) {
+	const struct row *x = a, *y = b;
+	if (x->section != y->section)
+		return x->section < y->section ? -1 : 1;
+	if (x->address != y->address)
+		return x->address < y->address ? -1 : 1;
+	return x->order - y->order;
+}
+
+struct buffer {
+	size_t size, cap;
+	uint8_t *data;
+
+	// Pointers to labels in the data, written with relocations.
+	size_t fixup_size, fixup_cap;
+	struct fixup {
+		size_t offset;
+		const char *label;
+		int type;
+	} *fixups;
+};
+
+static void emit_byte(struct buffer *b, uint8_t byte) {
+	ADD_ELEMENT(b->size, b->cap, b->data) = byte;
+}
+
+static void emit_bytes(struct buffer *b, const uint8_t *bytes, size_t n) {
+	memcpy(ADD_ELEMENTS(b->size, b->cap, b->data, n), bytes, n);
+}
+
+static void emit_value(struct buffer *b, uint64_t value, int size) {
+	emit_bytes(b, (uint8_t *)&value, size);
+}
+
+static void emit_uleb(struct buffer *b, uint64_t value) {
+	do {
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		emit_byte(b, value ? byte | 0x80 : byte);
+	} while (value);
+}
+
+static void emit_label(struct buffer *b, const char *label, int type, int size) {
+	ADD_ELEMENT(b->fixup_size, b->fixup_cap, b->fixups) = (struct fixup) { b->size, label, type };
+	emit_value(b, 0, size);
+}
+
+static int uleb_size(uint64_t value) {
+	int size = 1;
+	while (value >>= 7)
+		size++;
+	return size;
+}
+
+static void emit_sleb(struct buffer *b, int64_t value) {
+	for (;;) {
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+			emit_byte(b, byte);
+			return;
+		}
+		emit_byte(b, byte | 0x80);
+	}
+}
+
+static void emit_string(struct buffer *b, const char *str) {
+	emit_bytes(b, (const uint8_t *)str, strlen(str) + 1);
+}
+
+// Writes the buffer to the current section.
+static void write_buffer(struct buffer *b) {
+	size_t written = 0;
+	for (unsigned i = 0; i < b->fixup_size; i++) {
+		struct fixup *fixup = b->fixups + i;
+		elf_write(b->data + written, fixup->offset - written);
+		elf_symbol_relocate_here(fixup->label, 0, fixup->type, 0);
+		written = fixup->offset;
+	}
+	elf_write(b->data + written, b->size - written);
+}
+
+static struct buffer program;
+
+static void emit_extended(uint8_t opcode, uint64_t len) {
+	emit_byte(&program, 0);
+	emit_uleb(&program, len + 1);
+	emit_byte(&program, opcode);
+}
+
+// Appends a row after advancing the address and line, with a special
+// opcode if possible.
+static void emit_advance(uint64_t address_delta, int64_t line_delta) {
+	if (line_delta < LINE_BASE || line_delta >= LINE_BASE + LINE_RANGE) {
+		emit_byte(&program, DW_LNS_advance_line);
+		emit_sleb(&program, line_delta);
+		line_delta = 0;
+	}
+
+	uint64_t max_delta = (255 - OPCODE_BASE - (line_delta - LINE_BASE)) / LINE_RANGE;
+	uint64_t const_add = (255 - OPCODE_BASE) / LINE_RANGE;
+	if (address_delta > max_delta && address_delta <= max_delta + const_add) {
+		emit_byte(&program, DW_LNS_const_add_pc);
+		address_delta -= const_add;
+	} else if (address_delta > max_delta) {
+		emit_byte(&program, DW_LNS_advance_pc);
+		emit_uleb(&program, address_delta);
+		address_delta = 0;
+	}
+
+	emit_byte(&program, OPCODE_BASE + (line_delta - LINE_BASE) + LINE_RANGE * address_delta);
+}
+
+// One sequence per section, starting at the first row in it.
+static void emit_sequence(struct row *rows, int n) {
+	uint64_t address = rows[0].address;
+	int file = 1, line = 1, column = 0, is_stmt = 1;
+
+	emit_extended(DW_LNE_set_address, 8);
+	emit_label(&program, rows[0].label, R_X86_64_64, 8);
+
+	for (int i = 0; i < n; i++) {
+		struct loc *loc = &rows[i].loc;
+
+		if (loc->file != file) {
+			emit_byte(&program, DW_LNS_set_file);
+			emit_uleb(&program, loc->file);
+			file = loc->file;
+		}
+		if (loc->column != column) {
+			emit_byte(&program, DW_LNS_set_column);
+			emit_uleb(&program, loc->column);
+			column = loc->column;
+		}
+		// is_stmt is sticky from one .loc to the next.
+		if (loc->is_stmt != -1 && loc->is_stmt != is_stmt) {
+			emit_byte(&program, DW_LNS_negate_stmt);
+			is_stmt = loc->is_stmt;
+		}
+		if (loc->basic_block)
+			emit_byte(&program, DW_LNS_set_basic_block);
+		if (loc->prologue_end)
+			emit_byte(&program, DW_LNS_set_prologue_end);
+		if (loc->epilogue_begin)
+			emit_byte(&program, DW_LNS_set_epilogue_begin);
+		if (loc->discriminator) {
+			emit_extended(DW_LNE_set_discriminator, uleb_size(loc->discriminator));
+			emit_uleb(&program, loc->discriminator);
+		}
+
+		emit_advance(rows[i].address - address, loc->line - line);
+		address = rows[i].address;
+		line = loc->line;
+	}
+
+	uint64_t end = elf_section_end(rows[0].section);
+	if (end > address) {
+		emit_byte(&program, DW_LNS_advance_pc);
+		emit_uleb(&program, end - address);
+	}
+	emit_extended(DW_LNE_end_sequence, 0);
+}
+
+static void write_u16(uint16_t value) {
+	elf_write((uint8_t *)&value, 2);
+}
+
+static void write_u32(uint32_t value) {
+	elf_write((uint8_t *)&value, 4);
+}
+
+// Appends a DWARF 4 line table to .debug_line, after anything the input
+// put there, such as the .Ldebug_line0 label gcc refers to.
+static void write_line_table(void) {
+	if (!row_size)
+		return;
+
+	for (unsigned i = 0; i < row_size; i++) {
+		rows[i].section = elf_symbol_location(rows[i].label, &rows[i].address);
+		if (rows[i].section == -1)
+			ERROR("Line table label %s is undefined", rows[i].label);
+	}
+	qsort(rows, row_size, sizeof *rows, compare_rows);
+
+	// The header after the header_length field.
+	emit_byte(&program, 1); // minimum_instruction_length
+	emit_byte(&program, 1); // maximum_operations_per_instruction
+	emit_byte(&program, 1); // default_is_stmt
+	emit_byte(&program, (uint8_t)LINE_BASE);
+	emit_byte(&program, LINE_RANGE);
+	emit_byte(&program, OPCODE_BASE);
+	for (int i = 0; i < OPCODE_BASE - 1; i++)
+		emit_byte(&program, standard_opcode_lengths[i]);
+
+	for (unsigned i = 0; i < dir_size; i++)
+		emit_string(&program, dirs[i]);
+	emit_byte(&program, 0);
+
+	for (unsigned i = 1; i < file_size; i++) {
+		// Gaps in the numbering get a placeholder, as in gas.
+		emit_string(&program, files[i].name ? files[i].name : "");
+		emit_uleb(&program, files[i].dir);
+		emit_uleb(&program, 0); // Modification time
+		emit_uleb(&program, 0); // Length
+	}
+	emit_byte(&program, 0);
+	size_t program_start = program.size;
+
+	for (unsigned start = 0, end; start < row_size; start = end) {
+		for (end = start + 1; end < row_size && rows[end].section == rows[start].section; end++);
+		emit_sequence(rows + start, end - start);
+	}
+
+	elf_set_section(".debug_line");
+	write_u32(2 + 4 + program.size); // unit_length
+	write_u16(4); // version
+	write_u32(program_start); // header_length
+
+	write_buffer(&program);
+}
+
+// Call frame information, written to .eh_frame with the same layout as gas.
+#define CODE_ALIGNMENT 1
+#define DATA_ALIGNMENT (-8)
+#define RETURN_ADDRESS 16
+#define REG_RSP 7
+
+// FDEs with equal keys share a CIE.
+struct cie {
+	int simple, signal_frame;
+	int personality_encoding, lsda_encoding;
+	const char *personality;
+	size_t offset; // In .eh_frame, once written.
+};
+
+static size_t fde_size, fde_cap;
+static struct fde {
+	char *label;
+	int section;
+	uint64_t start, range; // Offsets in the section as assembled.
+	uint64_t last; // Location of the last instruction, from start.
+	struct cie cie;
+	const char *lsda;
+	struct buffer instructions;
+	uint64_t address; // Of label, after functions have been moved.
+} *fdes;
+
+static int in_frame = 0;
+
+// CFA offset, tracked for .cfi_adjust_cfa_offset and .cfi_rel_offset.
+static int64_t cfa_offset;
+static int n_saved_offsets;
+static int64_t saved_offsets[16];
+
+static void advance_to_here(struct fde *fde) {
+	uint64_t here = elf_section_offset() - fde->start;
+	uint64_t delta = (here - fde->last) / CODE_ALIGNMENT;
+	struct buffer *b = &fde->instructions;
+
+	if (!delta)
+		return;
+	if (delta < 0x40) {
+		emit_byte(b, DW_CFA_advance_loc | delta);
+	} else if (delta <= UINT8_MAX) {
+		emit_byte(b, DW_CFA_advance_loc1);
+		emit_value(b, delta, 1);
+	} else if (delta <= UINT16_MAX) {
+		emit_byte(b, DW_CFA_advance_loc2);
+		emit_value(b, delta, 2);
+	} else {
+		emit_byte(b, DW_CFA_advance_loc4);
+		emit_value(b, delta, 4);
+	}
+	fde->last = here;
+}
+
+static void emit_offset(struct buffer *b, int reg, int64_t offset) {
+	if (offset % DATA_ALIGNMENT)
+		ERROR("CFI offset %ld is not a multiple of %d", offset, -DATA_ALIGNMENT);
+
+	int64_t factored = offset / DATA_ALIGNMENT;
+	if (reg < 0x40 && factored >= 0) {
+		emit_byte(b, DW_CFA_offset | reg);
+		emit_uleb(b, factored);
+	} else {
+		emit_byte(b, DW_CFA_offset_extended_sf);
+		emit_uleb(b, reg);
+		emit_sleb(b, factored);
+	}
+}
+
+static void emit_cfa_offset(struct buffer *b, int64_t offset) {
+	if (offset < 0)
+		ERROR("Negative CFA offset %ld", offset);
+	emit_byte(b, DW_CFA_def_cfa_offset);
+	emit_uleb(b, offset);
+	cfa_offset = offset;
+}
+
+void dwarf_cfi(const struct cfi *cfi) {
+	if (cfi->type == CFI_SECTIONS)
+		return;
+
+	if (cfi->type == CFI_STARTPROC) {
+		if (in_frame)
+			ERROR(".cfi_startproc without .cfi_endproc");
+
+		char buffer[32];
+		sprintf(buffer, ".L.cfi.%lu", fde_size);
+		elf_symbol_set_here(buffer, 0);
+
+		struct fde *fde = &ADD_ELEMENT(fde_size, fde_cap, fdes);
+		*fde = (struct fde) {
+			.label = strdup(buffer),
+			.section = elf_current_section(),
+			.start = elf_section_offset(),
+			.cie = { .simple = cfi->simple, .personality_encoding = DW_EH_PE_omit,
+					 .lsda_encoding = DW_EH_PE_omit },
+		};
+		in_frame = 1;
+		cfa_offset = cfi->simple ? 0 : 8;
+		n_saved_offsets = 0;
+		return;
+	}
+
+	if (!in_frame)
+		ERROR("CFI directive outside of .cfi_startproc");
+
+	struct fde *fde = fdes + fde_size - 1;
+	struct buffer *b = &fde->instructions;
+
+	switch (cfi->type) {
+	case CFI_ENDPROC:
+		if (elf_current_section() != fde->section)
+			ERROR(".cfi_endproc in a different section than .cfi_startproc");
+		fde->range = elf_section_offset() - fde->start;
+		in_frame = 0;
+		return;
+	case CFI_PERSONALITY:
+		fde->cie.personality_encoding = cfi->symbol ? cfi->encoding : DW_EH_PE_omit;
+		fde->cie.personality = cfi->symbol;
+		return;
+	case CFI_LSDA:
+		fde->cie.lsda_encoding = cfi->symbol ? cfi->encoding : DW_EH_PE_omit;
+		fde->lsda = cfi->symbol;
+		return;
+	case CFI_SIGNAL_FRAME:
+		fde->cie.signal_frame = 1;
+		return;
+	default:
+		break;
+	}
+
+	advance_to_here(fde);
+
+	switch (cfi->type) {
+	case CFI_DEF_CFA:
+		if (cfi->offset < 0)
+			ERROR("Negative CFA offset %ld", cfi->offset);
+		emit_byte(b, DW_CFA_def_cfa);
+		emit_uleb(b, cfi->regs[0]);
+		emit_uleb(b, cfi->offset);
+		cfa_offset = cfi->offset;
+		break;
+	case CFI_DEF_CFA_REGISTER:
+		emit_byte(b, DW_CFA_def_cfa_register);
+		emit_uleb(b, cfi->regs[0]);
+		break;
+	case CFI_DEF_CFA_OFFSET:
+		emit_cfa_offset(b, cfi->offset);
+		break;
+	case CFI_ADJUST_CFA_OFFSET:
+		emit_cfa_offset(b, cfa_offset + cfi->offset);
+		break;
+	case CFI_OFFSET:
+		emit_offset(b, cfi->regs[0], cfi->offset);
+		break;
+	case CFI_REL_OFFSET:
+		emit_offset(b, cfi->regs[0], cfi->offset - cfa_offset);
+		break;
+	case CFI_REGISTER:
+		emit_byte(b, DW_CFA_register);
+		emit_uleb(b, cfi->regs[0]);
+		emit_uleb(b, cfi->regs[1]);
+		break;
+	case CFI_RESTORE:
+		if (cfi->regs[0] < 0x40) {
+			emit_byte(b, DW_CFA_restore | cfi->regs[0]);
+		} else {
+			emit_byte(b, DW_CFA_restore_extended);
+			emit_uleb(b, cfi->regs[0]);
+		}
+		break;
+	case CFI_UNDEFINED:
+		emit_byte(b, DW_CFA_undefined);
+		emit_uleb(b, cfi->regs[0]);
+		break;
+	case CFI_SAME_VALUE:
+		emit_byte(b, DW_CFA_same_value);
+		emit_uleb(b, cfi->regs[0]);
+		break;
+	case CFI_REMEMBER_STATE:
+		if (n_saved_offsets == sizeof saved_offsets / sizeof *saved_offsets)
+			ERROR("Too many nested .cfi_remember_state");
+		saved_offsets[n_saved_offsets++] = cfa_offset;
+		emit_byte(b, DW_CFA_remember_state);
+		break;
+	case CFI_RESTORE_STATE:
+		if (!n_saved_offsets)
+			ERROR(".cfi_restore_state without .cfi_remember_state");
+		cfa_offset = saved_offsets[--n_saved_offsets];
+		emit_byte(b, DW_CFA_restore_state);
+		break;
+	case CFI_ESCAPE:
+		emit_bytes(b, cfi->bytes, cfi->n_bytes);
+		break;
+	default:
+		ERROR("Unhandled CFI directive %d", cfi->type);
+	}
+}
+
+static int pointer_size(int encoding) {
+	switch (encoding & 0x0f) {
+	case DW_EH_PE_absptr: return 8;
+	case DW_EH_PE_udata4:
+	case DW_EH_PE_sdata4: return 4;
+	default: ERROR("Unsupported pointer encoding 0x%x", encoding);
+	}
+}
+
+static void emit_pointer(struct buffer *b, int encoding, const char *label) {
+	int size = pointer_size(encoding);
+	int type;
+	if ((encoding & 0x70) == DW_EH_PE_pcrel)
+		type = size == 8 ? R_X86_64_PC64 : R_X86_64_PC32;
+	else if ((encoding & 0x70) == 0)
+		type = size == 8 ? R_X86_64_64 : (encoding & 0x0f) == DW_EH_PE_sdata4 ? R_X86_64_32S : R_X86_64_32;
+	else
+		ERROR("Unsupported pointer encoding 0x%x", encoding);
+	emit_label(b, label, type, size);
+}
+
+// Entries are padded with DW_CFA_nop until the frame is a multiple of align
+// bytes long, and their length is filled in at the end.
+static void finish_entry(struct buffer *b, size_t start, int align) {
+	while (b->size % align)
+		emit_byte(b, DW_CFA_nop);
+	uint32_t length = b->size - start - 4;
+	memcpy(b->data + start, &length, 4);
+}
+
+static void emit_cie(struct buffer *b, struct cie *cie) {
+	cie->offset = b->size;
+	emit_value(b, 0, 4); // length
+	emit_value(b, 0, 4); // CIE_id
+	emit_byte(b, 1); // version
+
+	char augmentation[8] = "z";
+	if (cie->personality)
+		strcat(augmentation, "P");
+	if (cie->lsda_encoding != DW_EH_PE_omit)
+		strcat(augmentation, "L");
+	strcat(augmentation, "R");
+	if (cie->signal_frame)
+		strcat(augmentation, "S");
+	emit_string(b, augmentation);
+
+	emit_uleb(b, CODE_ALIGNMENT);
+	emit_sleb(b, DATA_ALIGNMENT);
+	emit_byte(b, RETURN_ADDRESS);
+
+	emit_uleb(b, (cie->personality ? 1 + pointer_size(cie->personality_encoding) : 0) +
+			  (cie->lsda_encoding != DW_EH_PE_omit) + 1);
+	if (cie->personality) {
+		emit_byte(b, cie->personality_encoding);
+		emit_pointer(b, cie->personality_encoding, cie->personality);
+	}
+	if (cie->lsda_encoding != DW_EH_PE_omit)
+		emit_byte(b, cie->lsda_encoding);
+	emit_byte(b, DW_EH_PE_pcrel | DW_EH_PE_sdata4); // FDE pointers
+
+	// The return address is at the CFA, which is %rsp + 8 on entry.
+	if (!cie->simple) {
+		emit_byte(b, DW_CFA_def_cfa);
+		emit_uleb(b, REG_RSP);
+		emit_uleb(b, -DATA_ALIGNMENT);
+		emit_offset(b, RETURN_ADDRESS, DATA_ALIGNMENT);
+	}
+
+	finish_entry(b, cie->offset, 4);
+}
+
+static int same_cie(struct cie *a, struct cie *b) {
+	return a->simple == b->simple && a->signal_frame == b->signal_frame &&
+		a->personality_encoding == b->personality_encoding &&
+		a->lsda_encoding == b->lsda_encoding &&
+		(a->personality == b->personality ||
+		 (a->personality && b->personality && strcmp(a->personality, b->personality) == 0));
+}
+
+static void write_eh_frame(void) {
+	if (in_frame)
+		ERROR(".cfi_startproc without .cfi_endproc");
+	if (!fde_size)
+		return;
+
+	struct buffer frame = { 0 };
+	size_t cie_size = 0, cie_cap = 0;
+	struct cie *cies = NULL;
+	size_t start = 0;
+
+	for (unsigned i = 0; i < fde_size; i++) {
+		struct fde *fde = fdes + i;
+		fde->section = elf_symbol_location(fde->label, &fde->address);
+
+		// Functions folded into another one leave their FDE behind.
+		int duplicate = 0;
+		for (unsigned j = 0; j < i && !duplicate; j++)
+			duplicate = fdes[j].section == fde->section && fdes[j].address == fde->address &&
+				fdes[j].range == fde->range;
+		if (duplicate)
+			continue;
+
+		struct cie *cie = NULL;
+		for (unsigned j = 0; j < cie_size && !cie; j++)
+			if (same_cie(cies + j, &fde->cie))
+				cie = cies + j;
+		if (!cie) {
+			cie = &ADD_ELEMENT(cie_size, cie_cap, cies);
+			*cie = fde->cie;
+			emit_cie(&frame, cie);
+		}
+
+		start = frame.size;
+		emit_value(&frame, 0, 4); // length
+		emit_value(&frame, frame.size - cie->offset, 4); // CIE_pointer
+		emit_label(&frame, fde->label, R_X86_64_PC32, 4); // pc_begin
+		emit_value(&frame, fde->range, 4); // pc_range
+
+		if (cie->lsda_encoding != DW_EH_PE_omit) {
+			emit_uleb(&frame, pointer_size(cie->lsda_encoding));
+			emit_pointer(&frame, cie->lsda_encoding, fde->lsda);
+		} else {
+			emit_uleb(&frame, 0);
+		}
+
+		emit_bytes(&frame, fde->instructions.data, fde->instructions.size);
+		finish_entry(&frame, start, 4);
+	}
+	// As in gas, the last FDE is padded to the address size so the section
+	// size stays a multiple of its alignment.
+	finish_entry(&frame, start, 8);
+
+	elf_set_section(".eh_frame");
+	elf_section_set_attributes("a", "progbits", 0);
+	elf_section_align(8);
+	elf_write_zero(-elf_section_offset() & 7);
+	write_buffer(&frame);
+}
+
+void dwarf_finish(void) {
+	dwarf_instruction();
+	write_line_table();
+	write_eh_frame();
+}
@@ -0,0 +1,15 @@
+#ifndef DWARF_H
+#define DWARF_H
+
+// DWARF line table built from .file and .loc directives, and call frame
+// information from the .cfi directives.
+
+#include "parser.h"
+
+void dwarf_file(int number, const char *dir, const char *name);
+void dwarf_loc(const struct loc *loc);
+void dwarf_instruction(void);
+void dwarf_cfi(const struct cfi *cfi);
+void dwarf_finish(void);
+
+#endif
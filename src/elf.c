@@ -4,6 +4,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 #define ERROR(STR, ...) do { printf("Error on line %d file %s: \"" STR "\"\n", __LINE__, __FILE__, ##__VA_ARGS__); exit(1); } while(0)
 #define NOTIMP() ERROR("Not implemented");
@@ -14,7 +23,19 @@ enum {
 	SHT_SYMTAB = 2,
 	SHT_STRTAB = 3,
 	SHT_RELA = 4,
+	SHT_NOTE = 7,
 	SHT_NOBITS = 8,
+	SHT_INIT_ARRAY = 14,
+	SHT_FINI_ARRAY = 15,
+	SHT_PREINIT_ARRAY = 16,
+	SHT_SYMTAB_SHNDX = 18,
+	SHT_X86_64_UNWIND = 0x70000001,
+};
+
+enum {
+	SHN_LORESERVE = 0xff00,
+	SHN_COMMON = 0xfff2,
+	SHN_XINDEX = 0xffff,
 };
 
 enum {
@@ -29,38 +50,28 @@ enum {
 	SHF_MERGE = (1 << 4), /* Might be merged */
 	SHF_STRINGS = (1 << 5), /* Contains nul-terminated strings */
 	SHF_INFO_LINK = (1 << 6), /* `sh_info' contains SHT index */
-	SHF_LINK_ORDER = (1 << 7) /* Preserve order after combining */
+	SHF_LINK_ORDER = (1 << 7), /* Preserve order after combining */
+	SHF_GROUP = (1 << 9), /* Section is member of a group */
+	SHF_TLS = (1 << 10), /* Section hold thread-local data */
+	SHF_GNU_RETAIN = (1 << 21) /* Not to be garbage collected by the linker */
 };
 
+#define SHF_EXCLUDE ((uint64_t)1 << 31) /* Excluded from links */
+
 enum {
 	STT_NOTYPE = 0,
-	STT_SECTION = 3
+	STT_OBJECT = 1,
+	STT_FUNC = 2,
+	STT_SECTION = 3,
+	STT_COMMON = 5,
+	STT_TLS = 6,
+	STT_GNU_IFUNC = 10
 };
 
-static size_t shstring_size, shstring_cap;
-static char *shstrings = NULL;
-
-int register_shstring(const char *str) {
-	char *space = ADD_ELEMENTS(shstring_size, shstring_cap, shstrings, strlen(str) + 1);
-
-	strcpy(space, str);
-
-	return space - shstrings;
-}
-
-static size_t string_size, string_cap;
-static char *strings = NULL;
-
-int register_string(const char *str) {
-	char *space = ADD_ELEMENTS(string_size, string_cap, strings, strlen(str) + 1);
-
-	strcpy(space, str);
-
-	return space - strings;
-}
-
 struct rela {
 	int symb_idx;
+	int sub_idx; // Subtracted symbol, -1 if none.
+	int size; // Only used for differences.
 	uint64_t offset;
 	uint64_t type;
 	uint64_t add;
@@ -70,22 +81,42 @@ struct section {
 	const char *name;
 	int idx;
 	int sh_idx;
+	int symbol; // STT_SECTION symbol.
 
 	size_t size, cap;
 	uint8_t *data;
+	int mapped; // data is a reserved range of which cap bytes are committed.
+	int type; // SHT_NOBITS sections only track their size, the contents are zero.
+	uint64_t flags, entsize;
+	uint64_t align;
 
 	size_t rela_size, rela_cap;
 	struct rela *relas;
+
+	// Alignment padding, sorted by offset.
+	size_t padding_size, padding_cap;
+	struct padding {
+		uint64_t offset, size;
+	} *paddings;
+
+	uint64_t terminator_end; // End of the last jmp, ret or ud2.
 };
 
 struct symbol {
-	int string_idx; // gotten from register_string()
+	int string_idx; // gotten from register_string() in elf_finish()
 	char *name;
 	uint64_t value;
 	uint64_t size;
 	int section;
 	int global;
 	int idx;
+	int address_significant; // Set by .addrsig_sym, never folded.
+	int common; // Undefined .comm symbol, value is the alignment.
+	int has_size; // Set by .size, or for common symbols.
+	int visibility; // STV_*, written to st_other.
+	int referenced; // By a relocation, set in elf_finish().
+	int discarded; // Left out of the symbol table.
+	int falls_into; // Code before it in the section can fall through to it.
 
 	int type;
 };
@@ -93,67 +124,530 @@ struct symbol {
 size_t symbol_size, symbol_cap;
 struct symbol *symbols;
 
+static uint64_t hash_string(const char *str) {
+	uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+	for (; *str; str++)
+		hash = (hash ^ (uint8_t)*str) * 0x100000001b3;
+	return hash;
+}
+
+// String tables are laid out once all strings are known. Equal strings
+// share an entry, and strings that are a suffix of another one point into
+// it, so .text is found inside .rela.text.
+struct string_table {
+	size_t size, cap;
+	struct string_entry {
+		const char *str;
+		size_t len;
+		uint32_t offset;
+	} *entries;
+
+	// Open addressing from string to entry index, as for symbols.
+	size_t hash_cap;
+	int *hash;
+
+	size_t data_size, data_cap;
+	char *data;
+};
+
+static struct string_table strtab, shstrtab;
+
+static int string_table_find_slot(struct string_table *table, const char *str) {
+	size_t mask = table->hash_cap - 1;
+	size_t slot = hash_string(str) & mask;
+	while (table->hash[slot] != -1 && strcmp(table->entries[table->hash[slot]].str, str) != 0)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+// Returns a handle which string_table_offset() turns into an offset after
+// string_table_build().
+static int string_table_add(struct string_table *table, const char *str) {
+	if (table->size * 2 >= table->hash_cap) {
+		free(table->hash);
+		table->hash_cap = table->hash_cap ? table->hash_cap * 2 : 64;
+		table->hash = malloc(sizeof *table->hash * table->hash_cap);
+		memset(table->hash, -1, sizeof *table->hash * table->hash_cap);
+		for (unsigned i = 0; i < table->size; i++)
+			table->hash[string_table_find_slot(table, table->entries[i].str)] = i;
+	}
+
+	int slot = string_table_find_slot(table, str);
+	if (table->hash[slot] == -1) {
+		ADD_ELEMENT(table->size, table->cap, table->entries) = (struct string_entry) { strdup(str), strlen(str) };
+		table->hash[slot] = table->size - 1;
+	}
+	return table->hash[slot];
+}
+
+// Character pos from the end, or -1 past the start of the string.
+static int char_from_end(struct string_entry *entry, size_t pos) {
+	return pos < entry->len ? (uint8_t)entry->str[entry->len - pos - 1] : -1;
+}
+
+// Multikey quicksort of the reversed strings in descending order, so that
+// a string comes after the ones it is a suffix of.
+static void sort_reversed(struct string_entry **v, size_t n, size_t pos) {
+	while (n > 1) {
+		// [0, i) is above the pivot, [i, j) equal and [j, n) below.
+		int pivot = char_from_end(v[0], pos);
+		size_t i = 0, j = n;
+		for (size_t k = 1; k < j;) {
+			int c = char_from_end(v[k], pos);
+			struct string_entry *tmp = v[k];
+			if (c > pivot) {
+				v[k++] = v[i];
+				v[i++] = tmp;
+			} else if (c < pivot) {
+				v[k] = v[--j];
+				v[j] = tmp;
+			} else {
+				k++;
+			}
+		}
+
+		sort_reversed(v, i, pos);
+		sort_reversed(v + j, n - j, pos);
+		if (pivot == -1)
+			return;
+		v += i;
+		n = j - i;
+		pos++;
+	}
+}
+
+static void string_table_build(struct string_table *table) {
+	struct string_entry **sorted = malloc(sizeof *sorted * table->size);
+	for (unsigned i = 0; i < table->size; i++)
+		sorted[i] = table->entries + i;
+	sort_reversed(sorted, table->size, 0);
+
+	// The table starts with the empty string.
+	ADD_ELEMENT(table->data_size, table->data_cap, table->data) = '\0';
+
+	struct string_entry *last = NULL;
+	for (unsigned i = 0; i < table->size; i++) {
+		struct string_entry *entry = sorted[i];
+		if (!entry->len) {
+			entry->offset = 0;
+		} else if (last && last->len >= entry->len &&
+				   memcmp(last->str + last->len - entry->len, entry->str, entry->len) == 0) {
+			entry->offset = last->offset + last->len - entry->len;
+		} else {
+			char *space = ADD_ELEMENTS(table->data_size, table->data_cap, table->data, entry->len + 1);
+			memcpy(space, entry->str, entry->len + 1);
+			entry->offset = space - table->data;
+			last = entry;
+		}
+	}
+
+	free(sorted);
+}
+
+static uint32_t string_table_offset(struct string_table *table, int handle) {
+	return table->entries[handle].offset;
+}
+
+int register_string(const char *str) {
+	return string_table_add(&strtab, str);
+}
+
+int register_shstring(const char *str) {
+	return string_table_add(&shstrtab, str);
+}
+
+// Open addressing hash table from name to symbol index, -1 marks an empty slot.
+// The capacity is a power of two, and the table is kept at most half full.
+static size_t symbol_hash_size, symbol_hash_cap;
+static int *symbol_hash = NULL;
+
+static void symbol_hash_insert(int idx) {
+	size_t mask = symbol_hash_cap - 1;
+	size_t slot = hash_string(symbols[idx].name) & mask;
+	while (symbol_hash[slot] != -1)
+		slot = (slot + 1) & mask;
+	symbol_hash[slot] = idx;
+	symbol_hash_size++;
+}
+
+static void symbol_hash_add(int idx) {
+	if (2 * (symbol_hash_size + 1) > symbol_hash_cap) {
+		free(symbol_hash);
+		symbol_hash_cap = MAX(symbol_hash_cap * 2, 64);
+		symbol_hash = malloc(sizeof *symbol_hash * symbol_hash_cap);
+		memset(symbol_hash, -1, sizeof *symbol_hash * symbol_hash_cap);
+
+		symbol_hash_size = 0;
+		for (unsigned i = 0; i < symbol_size; i++)
+			if (symbols[i].name && (int)i != idx)
+				symbol_hash_insert(i);
+	}
+
+	symbol_hash_insert(idx);
+}
+
 static int find_symbol(const char *name) {
-	for (unsigned i = 0; i < symbol_size; i++)
-		if (symbols[i].name && strcmp(symbols[i].name, name) == 0)
-			return i;
+	if (!symbol_hash_cap)
+		return -1;
+
+	size_t mask = symbol_hash_cap - 1;
+	for (size_t slot = hash_string(name) & mask; symbol_hash[slot] != -1; slot = (slot + 1) & mask)
+		if (strcmp(symbols[symbol_hash[slot]].name, name) == 0)
+			return symbol_hash[slot];
 	return -1;
 }
 
 int elf_new_symbol(const char *name) {
 	struct symbol symb = { .section = -1, .global = -1 };
-	if (name) {
-		symb.string_idx = register_string(name);
+	if (name)
 		symb.name = strdup(name);
-	}
 
 	ADD_ELEMENT(symbol_size, symbol_cap, symbols) = symb;
 
+	if (name)
+		symbol_hash_add(symbol_size - 1);
+
 	return symbol_size - 1;
 }
 
 size_t section_size, section_cap;
 struct section *sections = NULL;
 
+// Section names to indices, kept like the symbol hash table.
+static size_t section_hash_cap;
+static int *section_hash = NULL;
+
+static size_t section_hash_slot(const char *name) {
+	size_t mask = section_hash_cap - 1;
+	size_t slot = hash_string(name) & mask;
+	while (section_hash[slot] != -1 && strcmp(sections[section_hash[slot]].name, name) != 0)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
 struct section *current_section = NULL;
 
+static int keep_local_labels = 0;
+static int auto_size_symbols = 0;
+static int branch_alignment = 0;
+
+// Attributes of sections created without explicit flags, as in gas.
+// A prefix also matches names continuing with a dot, as .text.foo.
+static const struct {
+	const char *prefix;
+	int type;
+	uint64_t flags, entsize;
+} default_attributes[] = {
+	{ ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR },
+	{ ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
+	{ ".data1", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
+	{ ".rodata", SHT_PROGBITS, SHF_ALLOC },
+	{ ".rodata1", SHT_PROGBITS, SHF_ALLOC },
+	{ ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE },
+	{ ".tdata", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE | SHF_TLS },
+	{ ".tbss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE | SHF_TLS },
+	{ ".init_array", SHT_INIT_ARRAY, SHF_ALLOC | SHF_WRITE, 8 },
+	{ ".fini_array", SHT_FINI_ARRAY, SHF_ALLOC | SHF_WRITE, 8 },
+	{ ".preinit_array", SHT_PREINIT_ARRAY, SHF_ALLOC | SHF_WRITE, 8 },
+	{ ".note", SHT_NOTE, 0 },
+};
+
+static int has_prefix(const char *name, const char *prefix) {
+	size_t len = strlen(prefix);
+	return strncmp(name, prefix, len) == 0 && (name[len] == '\0' || name[len] == '.');
+}
+
+static void set_default_attributes(struct section *section) {
+	section->type = SHT_PROGBITS;
+	section->flags = 0;
+	section->entsize = 0;
+
+	for (unsigned i = 0; i < sizeof default_attributes / sizeof *default_attributes; i++) {
+		if (has_prefix(section->name, default_attributes[i].prefix)) {
+			section->type = default_attributes[i].type;
+			section->flags = default_attributes[i].flags;
+			section->entsize = default_attributes[i].entsize;
+			break;
+		}
+	}
+
+	// Constants and strings of a size given in the name, as emitted by
+	// compilers, can be merged by the linker.
+	unsigned size, align;
+	char end;
+	if (sscanf(section->name, ".rodata.str%u.%u%c", &size, &align, &end) == 2 && size) {
+		section->flags |= SHF_MERGE | SHF_STRINGS;
+		section->entsize = size;
+	} else if (sscanf(section->name, ".rodata.cst%u%c", &size, &end) == 1 && size) {
+		section->flags |= SHF_MERGE;
+		section->entsize = size;
+	}
+}
+
+static int is_tls_relocation(int type) {
+	switch (type) {
+	case R_X86_64_DTPMOD64:
+	case R_X86_64_DTPOFF64:
+	case R_X86_64_TPOFF64:
+	case R_X86_64_TLSGD:
+	case R_X86_64_TLSLD:
+	case R_X86_64_DTPOFF32:
+	case R_X86_64_GOTTPOFF:
+	case R_X86_64_TPOFF32:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 void elf_init(void) {
 	elf_set_section(".text");
-	register_string("");
 }
 
 void elf_set_section(const char *section) {
-	for (unsigned i = 0; i < section_size; i++) {
-		if (strcmp(sections[i].name, section) == 0) {
-			current_section = sections + i;
-			return;
-		}
+	if (2 * (section_size + 1) > section_hash_cap) {
+		free(section_hash);
+		section_hash_cap = MAX(section_hash_cap * 2, 64);
+		section_hash = malloc(sizeof *section_hash * section_hash_cap);
+		memset(section_hash, -1, sizeof *section_hash * section_hash_cap);
+		for (unsigned i = 0; i < section_size; i++)
+			section_hash[section_hash_slot(sections[i].name)] = i;
+	}
+
+	size_t slot = section_hash_slot(section);
+	if (section_hash[slot] != -1) {
+		current_section = sections + section_hash[slot];
+		return;
 	}
 
+	section_hash[slot] = section_size;
 	current_section = &ADD_ELEMENT(section_size, section_cap, sections);
 	*current_section = (struct section) {
 		.name = strdup(section),
 		.idx = section_size - 1,
+		.align = 1,
 	};
+	set_default_attributes(current_section);
 
 	int section_symb = elf_new_symbol(NULL);
 	symbols[section_symb].global = 0;
 	symbols[section_symb].section = current_section->idx;
 	symbols[section_symb].value = 0;
 	symbols[section_symb].type = STT_SECTION;
+	current_section->symbol = section_symb;
+}
+
+uint64_t elf_section_offset(void) {
+	return current_section->size;
+}
+
+int elf_current_section(void) {
+	return current_section->idx;
+}
+
+uint64_t elf_section_end(int section) {
+	return sections[section].size;
+}
+
+// Returns the section index of a defined symbol and its offset in it, or -1.
+int elf_symbol_location(const char *name, uint64_t *value) {
+	int idx = find_symbol(name);
+	if (idx == -1 || symbols[idx].section == -1)
+		return -1;
+
+	*value = symbols[idx].value;
+	return symbols[idx].section;
+}
+
+// Applies the flags and type of a .section directive. Only the given
+// attributes replace the defaults.
+void elf_section_set_attributes(const char *flags, const char *type, uint64_t entsize) {
+	static const struct {
+		char letter;
+		uint64_t flag;
+	} letters[] = {
+		{ 'a', SHF_ALLOC },
+		{ 'w', SHF_WRITE },
+		{ 'x', SHF_EXECINSTR },
+		{ 'M', SHF_MERGE },
+		{ 'S', SHF_STRINGS },
+		{ 'T', SHF_TLS },
+		{ 'G', SHF_GROUP },
+		{ 'R', SHF_GNU_RETAIN },
+		{ 'e', SHF_EXCLUDE },
+	};
+
+	static const struct {
+		const char *name;
+		int type;
+	} types[] = {
+		{ "progbits", SHT_PROGBITS },
+		{ "nobits", SHT_NOBITS },
+		{ "note", SHT_NOTE },
+		{ "init_array", SHT_INIT_ARRAY },
+		{ "fini_array", SHT_FINI_ARRAY },
+		{ "preinit_array", SHT_PREINIT_ARRAY },
+		{ "unwind", SHT_X86_64_UNWIND },
+	};
+
+	struct section *section = current_section;
+
+	if (flags) {
+		section->flags = 0;
+		for (const char *c = flags; *c; c++) {
+			unsigned i = 0;
+			while (i < sizeof letters / sizeof *letters && letters[i].letter != *c)
+				i++;
+			if (i == sizeof letters / sizeof *letters)
+				ERROR("Unknown flag %c for section %s", *c, section->name);
+			section->flags |= letters[i].flag;
+		}
+		if (section->flags & SHF_GROUP)
+			ERROR("Section groups are not supported, section %s", section->name);
+	}
+
+	if (type) {
+		unsigned i = 0;
+		while (i < sizeof types / sizeof *types && strcmp(types[i].name, type) != 0)
+			i++;
+		if (i == sizeof types / sizeof *types)
+			ERROR("Unknown type @%s for section %s", type, section->name);
+
+		if (types[i].type != section->type && section->size)
+			ERROR("Changing the type of non-empty section %s", section->name);
+		section->type = types[i].type;
+	}
+
+	if (entsize)
+		section->entsize = entsize;
+
+	if ((section->flags & SHF_MERGE) && !section->entsize)
+		ERROR("Missing entry size for mergeable section %s", section->name);
+}
+
+static int is_code_section(struct section *section) {
+	return (section->flags & SHF_EXECINSTR) != 0;
+}
+
+int elf_section_is_code(void) {
+	return is_code_section(current_section);
+}
+
+void elf_section_align(uint64_t alignment) {
+	current_section->align = MAX(current_section->align, alignment);
+}
+
+// Marks everything written since start as alignment padding.
+void elf_mark_terminator(void) {
+	current_section->terminator_end = current_section->size;
+}
+
+// Code falls through to the current position unless it follows a jump or a
+// return, possibly with alignment padding in between.
+static int falls_into_here(void) {
+	struct section *section = current_section;
+	if (!is_code_section(section) || section->size == 0 || section->terminator_end == section->size)
+		return 0;
+
+	if (section->padding_size == 0)
+		return 1;
+	struct padding *padding = section->paddings + section->padding_size - 1;
+	return padding->offset != section->terminator_end || padding->offset + padding->size != section->size;
+}
+
+void elf_mark_padding(uint64_t start) {
+	if (start == current_section->size)
+		return;
+
+	ADD_ELEMENT(current_section->padding_size, current_section->padding_cap, current_section->paddings) =
+		(struct padding) { start, current_section->size - start };
+}
+
+// Section contents start out on the heap. Once they outgrow SECTION_HEAP_MAX
+// they are moved to a reserved range of address space, which is committed
+// as it is written, so large sections are never copied again.
+#define SECTION_HEAP_MAX ((size_t)1 << 20)
+#define SECTION_RESERVE ((size_t)1 << 36)
+
+static uint8_t *section_append(struct section *section, size_t len) {
+	size_t size = section->size + len;
+
+	if (size > section->cap && !section->mapped && size <= SECTION_HEAP_MAX) {
+		section->cap = MAX(section->cap * 2, size);
+		section->data = realloc(section->data, section->cap);
+	} else if (size > section->cap) {
+		if (size > SECTION_RESERVE)
+			ERROR("Section %s is too large", section->name);
+
+		size_t cap = MAX(section->cap * 2, (size + SECTION_HEAP_MAX - 1) & ~(SECTION_HEAP_MAX - 1));
+		cap = MIN(cap, SECTION_RESERVE);
+
+		if (!section->mapped) {
+			uint8_t *data = mmap(NULL, SECTION_RESERVE, PROT_NONE,
+								 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (data == MAP_FAILED || mprotect(data, cap, PROT_READ | PROT_WRITE) != 0)
+				ERROR("Could not reserve memory for section %s", section->name);
+
+			memcpy(data, section->data, section->size);
+			free(section->data);
+			section->data = data;
+			section->mapped = 1;
+		} else if (mprotect(section->data + section->cap, cap - section->cap, PROT_READ | PROT_WRITE) != 0) {
+			ERROR("Could not commit memory for section %s", section->name);
+		}
+
+		section->cap = cap;
+	}
+
+	uint8_t *space = section->data + section->size;
+	section->size = size;
+	return space;
+}
+
+static void section_free_data(struct section *section) {
+	if (section->mapped)
+		munmap(section->data, SECTION_RESERVE);
+	else
+		free(section->data);
+}
+
+// Writes len bytes of data, or zeros if data is NULL. Zeros need no storage in
+// NOBITS sections, and committed but unwritten memory is already zero.
+static void section_write(struct section *section, const uint8_t *data, size_t len) {
+	if (section->type == SHT_NOBITS) {
+		for (size_t i = 0; data && i < len; i++)
+			if (data[i])
+				ERROR("Non-zero data in section %s", section->name);
+		section->size += len;
+		return;
+	}
+
+	uint8_t *space = section_append(section, len);
+	if (data)
+		memcpy(space, data, len);
+	else if (!section->mapped)
+		memset(space, 0, len);
+}
+
+static void section_fill(struct section *section, uint8_t byte, size_t len) {
+	if (section->type == SHT_NOBITS || byte == 0)
+		section_write(section, NULL, len);
+	else
+		memset(section_append(section, len), byte, len);
 }
 
 void elf_write(uint8_t *data, int len) {
-	memcpy(ADD_ELEMENTS(current_section->size, current_section->cap, current_section->data, len),
-		   data, len);
+	section_write(current_section, data, len);
 }
 
 void elf_write_zero(int len) {
-	memset(ADD_ELEMENTS(current_section->size, current_section->cap, current_section->data, len),
-		   0, len);
+	section_write(current_section, NULL, len);
 }
 
-void elf_symbol_relocate_here(const char *name, int64_t offset, int type) {
+void elf_symbol_relocate_here(const char *name, int64_t offset, int type, int64_t addend) {
+	if (current_section->type == SHT_NOBITS)
+		ERROR("Relocation in section %s", current_section->name);
+
 	struct rela *rela = &ADD_ELEMENT(current_section->rela_size,
 									current_section->rela_cap,
 									current_section->relas);
@@ -165,13 +659,27 @@ void elf_symbol_relocate_here(const char *name, int64_t offset, int type) {
 	}
 
 	rela->symb_idx = idx;
+	rela->sub_idx = -1;
 	rela->offset = current_section->size + offset;
 	rela->type = type;
-	rela->add = 0;
+	rela->add = addend;
 
-	if (type == R_X86_64_PC32) {
-		rela->add = -4;
-	}
+	if (is_tls_relocation(type))
+		symbols[idx].type = STT_TLS;
+}
+
+// name - sub + addend, resolved by resolve_differences() once all symbols are known.
+void elf_symbol_difference_here(const char *name, const char *sub, int64_t offset, int size, int64_t addend) {
+	elf_symbol_relocate_here(name, offset, R_X86_64_NONE, addend);
+
+	struct rela *rela = current_section->relas + current_section->rela_size - 1;
+
+	int idx = find_symbol(sub);
+	if (idx == -1)
+		idx = elf_new_symbol(sub);
+
+	rela->sub_idx = idx;
+	rela->size = size;
 }
 
 void elf_symbol_set_here(const char *name, int64_t offset) {
@@ -181,6 +689,11 @@ void elf_symbol_set_here(const char *name, int64_t offset) {
 
 	symbols[idx].section = current_section->idx;
 	symbols[idx].value = current_section->size + offset;
+	symbols[idx].common = 0;
+	symbols[idx].falls_into = offset == 0 && falls_into_here();
+
+	if (current_section->flags & SHF_TLS)
+		symbols[idx].type = STT_TLS;
 
 	if (symbols[idx].global == -1)
 		symbols[idx].global = 0;
@@ -194,45 +707,663 @@ void elf_symbol_set_global(const char *name) {
 	symbols[idx].global = 1;
 }
 
-static FILE *output = NULL;
-size_t current_pos = 0;
+// Default alignments as in GNU as. .lcomm uses the largest power of two
+// not above the size, at most 8, .comm the smallest one not below, at most 16.
+static uint64_t default_local_common_alignment(uint64_t size) {
+	uint64_t alignment = 1;
+	while (alignment < 8 && alignment * 2 <= size)
+		alignment *= 2;
+	return alignment;
+}
 
-void write(const void *ptr, size_t size) {
-	current_pos += size;
-	if (fwrite(ptr, size, 1, output) != 1)
-		ERROR("Could not write to file");
+static uint64_t default_common_alignment(uint64_t size) {
+	uint64_t alignment = 1;
+	while (alignment < 16 && alignment < size)
+		alignment *= 2;
+	return alignment;
 }
 
-void write_null(size_t size) {
-	if (size == 0)
+// .lcomm, allocates size bytes in .bss.
+void elf_symbol_set_local_common(const char *name, uint64_t size, uint64_t alignment) {
+	int previous = current_section->idx;
+	if (!alignment)
+		alignment = default_local_common_alignment(size);
+	if (alignment & (alignment - 1))
+		ERROR("Alignment %lu of %s is not a power of two", alignment, name);
+
+	elf_set_section(".bss");
+	elf_section_align(alignment);
+	section_write(current_section, NULL, -current_section->size & (alignment - 1));
+	elf_symbol_set_here(name, 0);
+	symbols[find_symbol(name)].size = size;
+	symbols[find_symbol(name)].has_size = 1;
+	symbols[find_symbol(name)].type = STT_OBJECT;
+	section_write(current_section, NULL, size);
+
+	current_section = sections + previous;
+}
+
+// .comm, a global SHN_COMMON symbol allocated by the linker unless defined.
+void elf_symbol_set_common(const char *name, uint64_t size, uint64_t alignment) {
+	int idx = find_symbol(name);
+	if (idx == -1)
+		idx = elf_new_symbol(name);
+
+	if (symbols[idx].section != -1)
 		return;
+	if (alignment & (alignment - 1))
+		ERROR("Alignment %lu of %s is not a power of two", alignment, name);
+
+	symbols[idx].common = 1;
+	symbols[idx].global = 1;
+	symbols[idx].type = STT_OBJECT;
+	symbols[idx].size = MAX(symbols[idx].size, size);
+	symbols[idx].has_size = 1;
+	symbols[idx].value = alignment ? alignment : default_common_alignment(size);
+}
+
+void elf_symbol_set_type(const char *name, const char *type) {
+	static const struct {
+		const char *name, *alias;
+		int type;
+	} types[] = {
+		{ "function", "STT_FUNC", STT_FUNC },
+		{ "gnu_indirect_function", "STT_GNU_IFUNC", STT_GNU_IFUNC },
+		{ "object", "STT_OBJECT", STT_OBJECT },
+		{ "tls_object", "STT_TLS", STT_TLS },
+		{ "common", "STT_COMMON", STT_COMMON },
+		{ "notype", "STT_NOTYPE", STT_NOTYPE },
+	};
+
+	int idx = find_symbol(name);
+	if (idx == -1)
+		idx = elf_new_symbol(name);
+
+	for (unsigned i = 0; i < sizeof types / sizeof *types; i++) {
+		if (strcmp(types[i].name, type) != 0 && strcmp(types[i].alias, type) != 0)
+			continue;
+
+		// Objects in TLS sections stay STT_TLS, as in gas.
+		if (types[i].type != STT_OBJECT || symbols[idx].type != STT_TLS)
+			symbols[idx].type = types[i].type;
+		return;
+	}
+
+	ERROR("Unknown symbol type %s for %s", type, name);
+}
+
+void elf_symbol_set_visibility(const char *name, int visibility) {
+	int idx = find_symbol(name);
+	if (idx == -1)
+		idx = elf_new_symbol(name);
 
-	if (size > 512)
-		NOTIMP();
+	symbols[idx].visibility = visibility;
+}
 
-	uint8_t zero[512] = { 0 };
-	write(zero, size);
+// Sizes given as a difference, as in .size f, .-f, are computed once both
+// symbols are defined, before functions are moved around.
+static size_t pending_size_size, pending_size_cap;
+static struct pending_size {
+	int symbol, add, sub;
+	int64_t value;
+} *pending_sizes;
+
+static int try_set_size(struct pending_size *pending) {
+	struct symbol *add = pending->add == -1 ? NULL : symbols + pending->add;
+	struct symbol *sub = pending->sub == -1 ? NULL : symbols + pending->sub;
+	if ((add && add->section == -1) || (sub && sub->section == -1))
+		return 0;
+
+	if (!add && sub)
+		ERROR("Can not negate symbol %s in size of %s", sub->name, symbols[pending->symbol].name);
+	if (add && (!sub || add->section != sub->section))
+		ERROR("Size of %s is not a constant", symbols[pending->symbol].name);
+
+	int64_t size = pending->value;
+	if (add)
+		size += add->value - sub->value;
+	symbols[pending->symbol].size = size;
+	symbols[pending->symbol].has_size = 1;
+	return 1;
+}
+
+static int symbol_or_new(const char *name) {
+	if (!name)
+		return -1;
+	int idx = find_symbol(name);
+	return idx == -1 ? elf_new_symbol(name) : idx;
+}
+
+void elf_symbol_set_size(const char *name, const char *add, const char *sub, int64_t value) {
+	struct pending_size pending = { symbol_or_new(name), symbol_or_new(add), symbol_or_new(sub), value };
+	if (!try_set_size(&pending))
+		ADD_ELEMENT(pending_size_size, pending_size_cap, pending_sizes) = pending;
+}
+
+static void resolve_pending_sizes(void) {
+	for (unsigned i = 0; i < pending_size_size; i++)
+		if (!try_set_size(pending_sizes + i))
+			ERROR("Size of %s refers to an undefined symbol", symbols[pending_sizes[i].symbol].name);
+	pending_size_size = 0;
+}
+
+void elf_symbol_set_address_significant(const char *name) {
+	int idx = find_symbol(name);
+	if (idx == -1)
+		idx = elf_new_symbol(name);
+
+	symbols[idx].address_significant = 1;
+}
+
+// Code sections are split into functions at global and STT_FUNC symbols that
+// code does not fall through to. Local labels stay in the function around them.
+// Functions can then be moved around or folded into each other.
+struct function {
+	int symbol; // First symbol at the start, -1 if none.
+	uint64_t start, end;
+	uint64_t body_end; // End without alignment padding.
+	int rela_start, rela_end;
+	int folded; // Index of the function this is folded into, or its own index.
+	int address_significant;
+	uint64_t hash;
+	uint64_t new_start;
+};
+
+static int is_function_symbol(struct symbol *symbol, struct section *section) {
+	return symbol->section == section->idx && symbol->name && symbol->type != STT_SECTION &&
+		strncmp(symbol->name, ".L", 2) != 0 && (symbol->global == 1 || symbol->type == STT_FUNC);
+}
+
+static int starts_function(struct symbol *symbol, struct section *section, int globals_only) {
+	return is_function_symbol(symbol, section) && symbol->value < section->size &&
+		!symbol->falls_into && (!globals_only || symbol->global == 1);
+}
+
+static int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_symbol_value(const void *a, const void *b) {
+	uint64_t x = symbols[*(const int *)a].value, y = symbols[*(const int *)b].value;
+	return x < y ? -1 : x > y;
+}
+
+static int function_containing(struct function *functions, int n, uint64_t offset) {
+	int low = 0, high = n - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (functions[mid].start <= offset)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	return low;
+}
+
+// Functions start at every function symbol, or only at global ones.
+static int split_functions(struct section *section, struct function **functions, int globals_only) {
+	uint64_t *starts = malloc(sizeof *starts * (symbol_size + 1));
+	int n_starts = 0;
+	starts[n_starts++] = 0;
+	for (unsigned i = 0; i < symbol_size; i++) {
+		if (starts_function(symbols + i, section, globals_only))
+			starts[n_starts++] = symbols[i].value;
+	}
+
+	qsort(starts, n_starts, sizeof *starts, compare_uint64);
+
+	*functions = malloc(sizeof **functions * n_starts);
+	int n = 0;
+	for (int i = 0; i < n_starts; i++) {
+		if (i > 0 && starts[i] == starts[i - 1])
+			continue;
+		(*functions)[n] = (struct function) { .start = starts[i], .folded = n, .symbol = -1 };
+		n++;
+	}
+
+	int rela = 0;
+	for (int i = 0; i < n; i++) {
+		struct function *function = *functions + i;
+		function->end = i + 1 < n ? (*functions)[i + 1].start : section->size;
+		function->rela_start = rela;
+		while (rela < (int)section->rela_size && section->relas[rela].offset < function->end)
+			rela++;
+		function->rela_end = rela;
+		function->body_end = function->end;
+	}
+
+	// Trailing padding is regenerated when the functions are laid out.
+	for (int i = section->padding_size - 1; i >= 0; i--) {
+		struct padding *padding = section->paddings + i;
+		struct function *function = *functions + function_containing(*functions, n, padding->offset);
+		if (padding->offset + padding->size == function->body_end)
+			function->body_end = padding->offset;
+	}
+
+	for (unsigned i = 0; i < symbol_size; i++) {
+		if (symbols[i].section != section->idx || symbols[i].type == STT_SECTION ||
+			symbols[i].value >= section->size)
+			continue;
+
+		struct function *function = *functions + function_containing(*functions, n, symbols[i].value);
+		if (symbols[i].address_significant)
+			function->address_significant = 1;
+		if (function->symbol == -1 && function->start == symbols[i].value &&
+			starts_function(symbols + i, section, globals_only))
+			function->symbol = i;
+	}
+
+	free(starts);
+	return n;
+}
+
+// Lays out the functions of a section in the given order. Folded functions are
+// left out, and their symbols point to the function they were folded into.
+// Functions not in the order must have had their symbols moved elsewhere.
+// Functions keep their offset modulo the section alignment.
+static void rebuild_section(struct section *section, struct function *functions, int n,
+							const int *order, int n_order) {
+	struct section rebuilt = { .name = section->name, .type = section->type };
+	size_t rela_size = 0, rela_cap = 0;
+	struct rela *relas = NULL;
+	size_t padding_size = 0, padding_cap = 0;
+	struct padding *paddings = NULL;
+
+	for (int i = 0; i < n_order; i++) {
+		struct function *function = functions + order[i];
+		if (function->folded != order[i])
+			continue;
+
+		uint64_t padding = (function->start - rebuilt.size) & (section->align - 1);
+		if (padding)
+			ADD_ELEMENT(padding_size, padding_cap, paddings) = (struct padding) { rebuilt.size, padding };
+		section_fill(&rebuilt, is_code_section(section) ? 0x90 : 0, padding);
+
+		function->new_start = rebuilt.size;
+		section_write(&rebuilt, section->type == SHT_NOBITS ? NULL : section->data + function->start,
+					  function->body_end - function->start);
+
+		for (int j = function->rela_start; j < function->rela_end; j++) {
+			struct rela *rela = &ADD_ELEMENT(rela_size, rela_cap, relas);
+			*rela = section->relas[j];
+			rela->offset = rela->offset - function->start + function->new_start;
+		}
+	}
+
+	for (int i = 0; i < n; i++)
+		functions[i].new_start = functions[functions[i].folded].new_start;
+
+	for (unsigned i = 0; i < symbol_size; i++) {
+		struct symbol *symbol = symbols + i;
+		if (symbol->section != section->idx || symbol->type == STT_SECTION)
+			continue;
+
+		if (symbol->value >= section->size) {
+			symbol->value = symbol->value - section->size + rebuilt.size;
+			continue;
+		}
+
+		struct function *function = functions + function_containing(functions, n, symbol->value);
+		symbol->value = symbol->value - function->start + function->new_start;
+	}
+
+	section_free_data(section);
+	free(section->relas);
+	free(section->paddings);
+	section->data = rebuilt.data;
+	section->size = rebuilt.size;
+	section->cap = rebuilt.cap;
+	section->mapped = rebuilt.mapped;
+	section->relas = relas;
+	section->rela_size = rela_size;
+	section->rela_cap = rela_cap;
+	section->paddings = paddings;
+	section->padding_size = padding_size;
+	section->padding_cap = padding_cap;
+}
+
+static uint64_t hash_function(struct section *section, struct function *function) {
+	uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+	for (uint64_t i = function->start; i < function->body_end; i++)
+		hash = (hash ^ section->data[i]) * 0x100000001b3;
+
+	for (int i = function->rela_start; i < function->rela_end; i++) {
+		struct rela *rela = section->relas + i;
+		uint64_t values[] = { rela->offset - function->start, rela->type, rela->add };
+		for (unsigned j = 0; j < sizeof values / sizeof *values; j++)
+			hash = (hash ^ values[j]) * 0x100000001b3;
+	}
+
+	return hash;
+}
+
+static int function_root(struct function *functions, int i) {
+	while (functions[i].folded != i)
+		i = functions[i].folded;
+	return i;
+}
+
+// Symbols are the same if they are at the same offset in functions that are folded
+// together, or in the two functions being compared.
+static int same_target(struct section *section, struct function *functions, int n,
+					   int a, int b, int symbol_a, int symbol_b) {
+	if (symbol_a == symbol_b)
+		return 1;
+
+	struct symbol *sa = symbols + symbol_a, *sb = symbols + symbol_b;
+	if (sa->section != section->idx || sb->section != section->idx ||
+		sa->value >= section->size || sb->value >= section->size)
+		return 0;
+
+	int fa = function_containing(functions, n, sa->value);
+	int fb = function_containing(functions, n, sb->value);
+	if (sa->value - functions[fa].start != sb->value - functions[fb].start)
+		return 0;
+
+	return (fa == a && fb == b) || function_root(functions, fa) == function_root(functions, fb);
+}
+
+static int functions_equal(struct section *section, struct function *functions, int n, int a, int b) {
+	struct function *fa = functions + a, *fb = functions + b;
+	if (fa->hash != fb->hash || fa->body_end - fa->start != fb->body_end - fb->start ||
+		fa->rela_end - fa->rela_start != fb->rela_end - fb->rela_start)
+		return 0;
+
+	if (memcmp(section->data + fa->start, section->data + fb->start, fa->body_end - fa->start) != 0)
+		return 0;
+
+	for (int i = 0; i < fa->rela_end - fa->rela_start; i++) {
+		struct rela *ra = section->relas + fa->rela_start + i;
+		struct rela *rb = section->relas + fb->rela_start + i;
+		if (ra->offset - fa->start != rb->offset - fb->start || ra->type != rb->type ||
+			ra->add != rb->add || ra->size != rb->size)
+			return 0;
+
+		if (!same_target(section, functions, n, a, b, ra->symb_idx, rb->symb_idx))
+			return 0;
+
+		if ((ra->sub_idx == -1) != (rb->sub_idx == -1) ||
+			(ra->sub_idx != -1 && !same_target(section, functions, n, a, b, ra->sub_idx, rb->sub_idx)))
+			return 0;
+	}
+
+	return 1;
+}
+
+static struct function *sort_functions;
+
+static int compare_function_hash(const void *a, const void *b) {
+	const struct function *x = sort_functions + *(const int *)a, *y = sort_functions + *(const int *)b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Identical functions are folded into the first copy. This is repeated until
+// nothing changes, as functions calling folded functions may become identical.
+void elf_fold_identical_functions(void) {
+	resolve_pending_sizes();
+
+	int folded = 0;
+	uint64_t saved = 0;
+
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		if (!is_code_section(section))
+			continue;
+
+		struct function *functions;
+		int n = split_functions(section, &functions, 0);
+
+		int *order = malloc(sizeof *order * n);
+		for (int j = 0; j < n; j++) {
+			functions[j].hash = hash_function(section, functions + j);
+			order[j] = j;
+		}
+
+		sort_functions = functions;
+		qsort(order, n, sizeof *order, compare_function_hash);
+
+		for (int changed = 1; changed;) {
+			changed = 0;
+			for (int j = 0; j < n; j++) {
+				struct function *function = functions + order[j];
+				if (function->folded != order[j] || function->address_significant)
+					continue;
+
+				for (int k = j - 1; k >= 0 && functions[order[k]].hash == function->hash; k--) {
+					if (functions[order[k]].folded != order[k] ||
+						!functions_equal(section, functions, n, order[k], order[j]))
+						continue;
+
+					function->folded = order[k];
+					folded++;
+					saved += function->body_end - function->start;
+					changed = 1;
+					break;
+				}
+			}
+		}
+
+		for (int j = 0; j < n; j++) {
+			functions[j].folded = function_root(functions, j);
+			order[j] = j;
+		}
+		rebuild_section(section, functions, n, order, n);
+
+		free(order);
+		free(functions);
+	}
+
+	fprintf(stderr, "Folded %d identical functions, %lu bytes\n", folded, saved);
+}
+
+// Lays out the functions of code sections in the order given by names,
+// with functions that are not listed last in their original order.
+void elf_order_functions(const char **names, int n_names) {
+	resolve_pending_sizes();
+
+	for (int i = 0; i < n_names; i++) {
+		int idx = find_symbol(names[i]);
+		if (idx == -1 || symbols[idx].section == -1)
+			fprintf(stderr, "Warning: symbol ordering: no such symbol %s\n", names[i]);
+		else if (!is_code_section(sections + symbols[idx].section) ||
+				 !is_function_symbol(symbols + idx, sections + symbols[idx].section))
+			fprintf(stderr, "Warning: symbol ordering: %s is not a function\n", names[i]);
+	}
+
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		if (!is_code_section(section))
+			continue;
+
+		struct function *functions;
+		int n = split_functions(section, &functions, 0);
+
+		int *order = malloc(sizeof *order * n), n_order = 0;
+		int *placed = calloc(n, sizeof *placed);
+
+		for (int j = 0; j < n_names; j++) {
+			int idx = find_symbol(names[j]);
+			if (idx == -1 || !is_function_symbol(symbols + idx, section) ||
+				symbols[idx].value >= section->size)
+				continue;
+
+			int function = function_containing(functions, n, symbols[idx].value);
+			if (!placed[function]) {
+				placed[function] = 1;
+				order[n_order++] = function;
+			}
+		}
+
+		for (int j = 0; j < n; j++)
+			if (!placed[j])
+				order[n_order++] = j;
+
+		rebuild_section(section, functions, n, order, n);
+
+		free(placed);
+		free(order);
+		free(functions);
+	}
+}
+
+static uint64_t lowest_bit(uint64_t x) {
+	return x & -x;
+}
+
+// Moves every function or object starting at a global symbol to a section
+// of its own, as with -ffunction-sections and -fdata-sections.
+void elf_split_sections(int code, int data) {
+	resolve_pending_sizes();
+
+	unsigned n_sections = section_size;
+	for (unsigned i = 0; i < n_sections; i++) {
+		if (!(sections[i].flags & SHF_ALLOC) || (is_code_section(sections + i) ? !code : !data))
+			continue;
+
+		struct function *functions;
+		int n = split_functions(sections + i, &functions, 1);
+		int *order = malloc(sizeof *order * n), n_order = 0;
+
+		// Symbols by address, to move along with the functions they are in.
+		int *members = malloc(sizeof *members * symbol_size), n_members = 0, next = 0;
+		for (unsigned k = 0; k < symbol_size; k++)
+			if (symbols[k].section == sections[i].idx && symbols[k].type != STT_SECTION &&
+				symbols[k].value < sections[i].size)
+				members[n_members++] = k;
+		qsort(members, n_members, sizeof *members, compare_symbol_value);
+
+		for (int j = 0; j < n; j++) {
+			struct function *function = functions + j;
+			while (next < n_members && symbols[members[next]].value < function->start)
+				next++;
+			if (function->symbol == -1) {
+				order[n_order++] = j;
+				continue;
+			}
+
+			const char *name = symbols[function->symbol].name;
+			char *section_name = malloc(strlen(sections[i].name) + strlen(name) + 2);
+			sprintf(section_name, "%s.%s", sections[i].name, name);
+
+			// Creating the section might move the section array.
+			elf_set_section(section_name);
+			struct section *section = sections + i;
+			struct section *dest = current_section;
+			dest->type = section->type;
+			dest->flags = section->flags;
+			dest->entsize = section->entsize;
+
+			// Code padded for branch alignment keeps its offset within 32 bytes.
+			uint64_t align = function->start ? MIN(section->align, lowest_bit(function->start)) : section->align;
+			if (branch_alignment && is_code_section(section))
+				align = MAX(align, 32);
+			elf_section_align(align);
+			uint64_t padding = (function->start - dest->size) & (align - 1);
+			section_fill(dest, is_code_section(dest) ? 0x90 : 0, padding);
+
+			uint64_t base = dest->size;
+			section_write(dest, section->type == SHT_NOBITS ? NULL : section->data + function->start,
+						  function->body_end - function->start);
+
+			for (int k = function->rela_start; k < function->rela_end; k++) {
+				struct rela *rela = &ADD_ELEMENT(dest->rela_size, dest->rela_cap, dest->relas);
+				*rela = section->relas[k];
+				rela->offset = rela->offset - function->start + base;
+			}
+
+			for (; next < n_members && symbols[members[next]].value < function->end; next++) {
+				struct symbol *symbol = symbols + members[next];
+				symbol->section = dest->idx;
+				symbol->value = symbol->value - function->start + base;
+			}
+		}
+
+		rebuild_section(sections + i, functions, n, order, n_order);
+
+		free(members);
+		free(order);
+		free(functions);
+	}
+}
+
+// The output is planned up front. Headers are built in memory, section
+// contents are referenced where they are, and everything is written with writev.
+static size_t current_pos = 0;
+
+static size_t header_size, header_cap;
+static uint8_t *header = NULL;
+
+static size_t iov_size, iov_cap;
+static struct iovec *iovs = NULL;
+
+static const uint8_t zero_page[4096];
+
+void write_bytes(const void *ptr, size_t size) {
+	memcpy(ADD_ELEMENTS(header_size, header_cap, header, size), ptr, size);
+	current_pos += size;
+}
+
+void write_null(size_t size) {
+	memset(ADD_ELEMENTS(header_size, header_cap, header, size), 0, size);
+	current_pos += size;
 }
 
 void write_skip(size_t target) {
 	write_null(target - current_pos);
 }
 
+static void output_add(const void *ptr, size_t size) {
+	ADD_ELEMENT(iov_size, iov_cap, iovs) = (struct iovec) { (void *)ptr, size };
+	current_pos += size;
+}
+
+static void output_skip(size_t target) {
+	while (current_pos < target)
+		output_add(zero_page, MIN(target - current_pos, sizeof zero_page));
+}
+
+static void output_write(const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		ERROR("Could not open %s", path);
+
+	size_t i = 0;
+	while (i < iov_size) {
+		ssize_t written = writev(fd, iovs + i, MIN(iov_size - i, IOV_MAX));
+		if (written < 0)
+			ERROR("Could not write to file");
+
+		// Partial writes continue from the middle of a buffer.
+		for (; i < iov_size && (size_t)written >= iovs[i].iov_len; i++)
+			written -= iovs[i].iov_len;
+		if (i < iov_size) {
+			iovs[i].iov_base = (uint8_t *)iovs[i].iov_base + written;
+			iovs[i].iov_len -= written;
+		}
+	}
+
+	if (close(fd) != 0)
+		ERROR("Could not write to file");
+}
+
 void write_byte(uint8_t byte) {
-	write(&byte, 1);
+	write_bytes(&byte, 1);
 }
 
 // TODO: Endianness??
 void write_word(uint16_t word) {
-	write(&word, 2);
+	write_bytes(&word, 2);
 }
 
 void write_long(uint32_t long_) {
-	write(&long_, 4);
+	write_bytes(&long_, 4);
 }
 
 void write_quad(uint64_t quad) {
-	write(&quad, 8);
+	write_bytes(&quad, 8);
 }
 
 #define SH_OFF 128
@@ -257,7 +1388,7 @@ uint64_t sh_address = 0;
 
 static void write_header(int shstrndx) {
 	static uint8_t magic[4] = {0x7f, 0x45, 0x4c, 0x46};
-	write(magic, sizeof magic);
+	write_bytes(magic, sizeof magic);
 
 	write_byte(2); // EI_CLASS = 64 bit
 	write_byte(1); // EI_DATA = little endian
@@ -282,8 +1413,10 @@ static void write_header(int shstrndx) {
 	write_word(0); // e_phentsize = 0
 	write_word(0); // e_phnum = 0
 	write_word(64); // e_shentsize = 0
-	write_word(elf_section_size); // e_shnum = 0
-	write_word(shstrndx); // e_shstrndx = 0
+
+	// Counts that don't fit are in the null section header instead.
+	write_word(elf_section_size < SHN_LORESERVE ? elf_section_size : 0); // e_shnum
+	write_word(shstrndx < SHN_LORESERVE ? shstrndx : SHN_XINDEX); // e_shstrndx
 }
 
 struct elf_section *add_elf_section(void) {
@@ -324,14 +1457,18 @@ static void write_section_headers(void) {
 		write_section_header(&section->header, section->size);
 	}
 
+	// The header buffer is complete, so it can be referenced.
+	ADD_ELEMENT(iov_size, iov_cap, iovs) = (struct iovec) { header, header_size };
+
 	for (unsigned i = 0; i < elf_section_size; i++) {
 		struct elf_section *section = elf_sections + i;
 
-		if (section->size == 0)
+		if (section->size == 0 || section->header.sh_type == SHT_NOBITS ||
+			section->header.sh_type == SHT_NULL)
 			continue;
 
-		write_skip(section->header.sh_offset);
-		write(section->data, section->size);
+		output_skip(section->header.sh_offset);
+		output_add(section->data, section->size);
 	}
 }
 
@@ -345,56 +1482,65 @@ static void allocate_sections(void) {
 		if (i == 0)
 			continue;
 
+		uint64_t align = MAX(section->header.sh_addralign, 1);
+		address = (address + align - 1) / align * align;
+
 		section->header.sh_offset = address;
-		address += section->size;
+		if (section->header.sh_type != SHT_NOBITS)
+			address += section->size;
 	}
 }
 
-uint8_t *symbol_table_write(int *n_local) {
-	uint8_t *buffer = calloc((symbol_size + 1), 24);
+// Section indices from SHN_LORESERVE up are written as SHN_XINDEX, with
+// the real index in the parallel .symtab_shndx table, if there is one.
+static void write_symbol(uint8_t *buffer, uint32_t *shndx, int entry, struct symbol *symbol, uint8_t info) {
+	uint8_t *ent_addr = buffer + entry * 24;
+	uint32_t section = 0;
+	if (symbol->section != -1)
+		section = sections[symbol->section].sh_idx;
+	else if (symbol->common)
+		section = SHN_COMMON;
+
+	*(uint32_t *)(ent_addr + 0) = string_table_offset(&strtab, symbol->string_idx); // st_name
+	*(uint8_t *)(ent_addr + 4) = info; // st_info
+	*(uint8_t *)(ent_addr + 5) = symbol->visibility; // st_other
+	if (symbol->section != -1 && section >= SHN_LORESERVE) {
+		*(uint16_t *)(ent_addr + 6) = SHN_XINDEX; // st_shndx
+		shndx[entry] = section;
+	} else {
+		*(uint16_t *)(ent_addr + 6) = section; // st_shndx
+	}
+	*(uint64_t *)(ent_addr + 8) = symbol->value; // st_value
+	*(uint64_t *)(ent_addr + 16) = symbol->size; // st_size
+
+	symbol->idx = entry;
+}
 
+uint8_t *symbol_table_write(int *n_local, int *n_entries, uint32_t *shndx) {
 	*n_local = 1;
+	*n_entries = 1;
 	for (unsigned i = 0; i < symbol_size; i++) {
+		if (symbols[i].discarded)
+			continue;
 		if (!symbols[i].global)
 			(*n_local)++;
+		(*n_entries)++;
 	}
 
+	uint8_t *buffer = calloc(*n_entries, 24);
+
 	int curr_entry = 0;
 
 	for (unsigned i = 0; i < symbol_size; i++) {
-		if (symbols[i].global)
+		if (symbols[i].global || symbols[i].discarded)
 			continue;
-		curr_entry++;
-		uint8_t *ent_addr = buffer + (curr_entry) * 24;
-		*(uint32_t *)(ent_addr + 0) = symbols[i].string_idx; // st_name
-		*(uint8_t *)(ent_addr + 4) = symbols[i].type; // st_info
-		*(uint8_t *)(ent_addr + 5) = 0; // st_other
-		if (symbols[i].section != -1)
-			*(uint16_t *)(ent_addr + 6) = sections[symbols[i].section].sh_idx; // st_shndx
-		else
-			*(uint16_t *)(ent_addr + 6) = 0; // st_shndx
-		*(uint64_t *)(ent_addr + 8) = symbols[i].value; // st_value
-		*(uint64_t *)(ent_addr + 16) = 0; // st_size
-
-		symbols[i].idx = curr_entry;
+		write_symbol(buffer, shndx, ++curr_entry, symbols + i, symbols[i].type);
 	}
 
 	for (unsigned i = 0; i < symbol_size; i++) {
-		if (!symbols[i].global)
+		if (!symbols[i].global || symbols[i].discarded)
 			continue;
-		curr_entry++;
-		uint8_t *ent_addr = buffer + (curr_entry) * 24;
-		*(uint32_t *)(ent_addr + 0) = symbols[i].string_idx; // st_name
-		*(uint8_t *)(ent_addr + 4) = STB_GLOBAL << 4 | symbols[i].type; // st_info
-		*(uint8_t *)(ent_addr + 5) = 0; // st_other
-		if (symbols[i].section != -1)
-			*(uint16_t *)(ent_addr + 6) = sections[symbols[i].section].sh_idx; // st_shndx
-		else
-			*(uint16_t *)(ent_addr + 6) = 0; // st_shndx
-		*(uint64_t *)(ent_addr + 8) = symbols[i].value; // st_value
-		*(uint64_t *)(ent_addr + 16) = 0; // st_size
-
-		symbols[i].idx = curr_entry;
+		write_symbol(buffer, shndx, ++curr_entry, symbols + i, STB_GLOBAL << 4 | symbols[i].type);
 	}
 
 	return buffer;
@@ -417,41 +1563,250 @@ uint8_t *rela_write(struct section *section) {
 	return buffer;
 }
 
+// Differences within a section are folded into the data. Otherwise the
+// subtracted symbol must be in the section being relocated, and the
+// difference becomes a PC relative relocation.
+static void resolve_differences(void) {
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		size_t n = 0;
+
+		for (unsigned j = 0; j < section->rela_size; j++) {
+			struct rela *rela = section->relas + j;
+			if (rela->sub_idx == -1) {
+				section->relas[n++] = *rela;
+				continue;
+			}
+
+			struct symbol *add = symbols + rela->symb_idx;
+			struct symbol *sub = symbols + rela->sub_idx;
+
+			if (sub->section == -1)
+				ERROR("Can not subtract undefined symbol %s", sub->name);
+
+			int64_t value = rela->add - sub->value;
+			if (add->section == sub->section) {
+				// Both signed and unsigned values are accepted, as with constants.
+				value += add->value;
+				if (rela->size < 8 && (value < -((int64_t)1 << (rela->size * 8 - 1)) ||
+									   value >= (int64_t)1 << (rela->size * 8)))
+					ERROR("Difference %s - %s does not fit in %d bytes", add->name, sub->name, rela->size);
+				memcpy(section->data + rela->offset, &value, rela->size);
+				continue;
+			}
+
+			if (sub->section != section->idx)
+				ERROR("Can not subtract %s from %s, they are in different sections", sub->name, add->name);
+
+			if (rela->size != 4 && rela->size != 8)
+				ERROR("Invalid size of PC relative difference %s - %s", add->name, sub->name);
+
+			rela->type = rela->size == 8 ? R_X86_64_PC64 : R_X86_64_PC32;
+			rela->add = value + rela->offset;
+			rela->sub_idx = -1;
+			section->relas[n++] = *rela;
+		}
+
+		section->rela_size = n;
+	}
+}
+
+static int pc_relative_size(int type) {
+	switch (type) {
+	case R_X86_64_PC8: return 1;
+	case R_X86_64_PC16: return 2;
+	case R_X86_64_PC32:
+	case R_X86_64_PLT32: return 4;
+	case R_X86_64_PC64: return 8;
+	default: return 0;
+	}
+}
+
+// PC relative references to local symbols in the same section do not
+// depend on where the section is placed, so they are written directly.
+static void resolve_local_relocations(void) {
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		size_t n = 0;
+
+		for (unsigned j = 0; j < section->rela_size; j++) {
+			struct rela *rela = section->relas + j;
+			struct symbol *symbol = symbols + rela->symb_idx;
+			int size = pc_relative_size(rela->type);
+
+			if (!size || symbol->section != section->idx || symbol->global == 1) {
+				section->relas[n++] = *rela;
+				continue;
+			}
+
+			int64_t value = symbol->value + rela->add - rela->offset;
+			if (size < 8 && (value < -((int64_t)1 << (size * 8 - 1)) ||
+							 value >= (int64_t)1 << (size * 8 - 1)))
+				ERROR("Reference to %s out of range", symbol->name);
+			memcpy(section->data + rela->offset, &value, size);
+		}
+
+		section->rela_size = n;
+	}
+}
+
+// Relocations that only need the address of a symbol, as opposed to a GOT,
+// PLT or TLS entry for it.
+static int is_address_relocation(int type) {
+	switch (type) {
+	case R_X86_64_64:
+	case R_X86_64_32:
+	case R_X86_64_32S:
+	case R_X86_64_16:
+	case R_X86_64_8:
+	case R_X86_64_PC64:
+	case R_X86_64_PC32:
+	case R_X86_64_PC16:
+	case R_X86_64_PC8:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Relocations against defined local symbols refer to the section symbol
+// with the symbol value in the addend. .L labels that are no longer
+// referenced are then left out of the symbol table.
+// As in gas, a non-zero addend into a mergeable section keeps the symbol,
+// otherwise the linker could not tell which entry is referenced.
+static void relocate_against_sections(void) {
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		for (unsigned j = 0; j < section->rela_size; j++) {
+			struct rela *rela = section->relas + j;
+			struct symbol *symbol = symbols + rela->symb_idx;
+
+			if (symbol->section != -1 && symbol->global != 1 && symbol->type != STT_SECTION &&
+				is_address_relocation(rela->type) &&
+				!((sections[symbol->section].flags & SHF_MERGE) && rela->add)) {
+				rela->add += symbol->value;
+				rela->symb_idx = sections[symbol->section].symbol;
+			}
+			symbols[rela->symb_idx].referenced = 1;
+		}
+	}
+
+	for (unsigned i = 0; i < symbol_size; i++) {
+		struct symbol *symbol = symbols + i;
+		symbol->discarded = !keep_local_labels && symbol->name && strncmp(symbol->name, ".L", 2) == 0 &&
+			symbol->section != -1 && symbol->global != 1 && !symbol->referenced;
+	}
+}
+
+void elf_keep_local_labels(void) {
+	keep_local_labels = 1;
+}
+
+// Global symbols without a .size run to the next global symbol, leaving out
+// trailing alignment padding. Those without a .type get one from their section.
+static void size_global_symbols(void) {
+	for (unsigned i = 0; i < section_size; i++) {
+		struct section *section = sections + i;
+		if (!(section->flags & SHF_ALLOC))
+			continue;
+
+		struct function *functions;
+		int n = split_functions(section, &functions, 1);
+
+		for (unsigned j = 0; j < symbol_size; j++) {
+			struct symbol *symbol = symbols + j;
+			if (symbol->section != section->idx || symbol->global != 1 ||
+				symbol->type == STT_SECTION || symbol->value >= section->size)
+				continue;
+
+			struct function *function = functions + function_containing(functions, n, symbol->value);
+			if (!symbol->has_size && function->start == symbol->value)
+				symbol->size = function->body_end - function->start;
+			if (symbol->type == STT_NOTYPE)
+				symbol->type = is_code_section(section) ? STT_FUNC : STT_OBJECT;
+		}
+
+		free(functions);
+	}
+}
+
+void elf_auto_size_symbols(void) {
+	auto_size_symbols = 1;
+}
+
+void elf_keep_branch_alignment(void) {
+	branch_alignment = 1;
+}
+
 void elf_finish(const char *path) {
-	output = fopen(path, "wb");
+	resolve_pending_sizes();
+	if (auto_size_symbols)
+		size_global_symbols();
+
+	resolve_differences();
+	resolve_local_relocations();
+	relocate_against_sections();
+
 	int null_section = elf_add_section(register_shstring(""), SHT_NULL);
 
 	for (unsigned i = 0; i < section_size; i++) {
 		struct section *section = sections + i;
-		int id = elf_add_section(register_shstring(section->name), SHT_PROGBITS);
+		int id = elf_add_section(register_shstring(section->name), section->type);
 
 		elf_sections[id].size = section->size;
 		elf_sections[id].data = section->data;
-		elf_sections[id].header.sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+		elf_sections[id].header.sh_addralign = section->align;
+		elf_sections[id].header.sh_flags = section->flags;
+		elf_sections[id].header.sh_entsize = section->entsize;
 
 		section->sh_idx = id;
 	}
 
+	for (unsigned i = 0; i < symbol_size; i++)
+		if (!symbols[i].discarded)
+			symbols[i].string_idx = register_string(symbols[i].name ? symbols[i].name : "");
+	string_table_build(&strtab);
+
 	int sym = elf_add_section(register_shstring(".symtab"), SHT_SYMTAB);
 	elf_sections[sym].header.sh_entsize = 24;
-	elf_sections[sym].size = (symbol_size + 1) * 24;
-	int n_local_symb = 0;
-	elf_sections[sym].data = symbol_table_write(&n_local_symb);
+	elf_sections[sym].header.sh_addralign = 8;
+	int n_local_symb = 0, n_symb = 0;
+
+	// Sections are numbered from 1, after the null section.
+	int symtab_shndx = -1;
+	uint32_t *shndx = NULL;
+	if (section_size >= SHN_LORESERVE) {
+		symtab_shndx = elf_add_section(register_shstring(".symtab_shndx"), SHT_SYMTAB_SHNDX);
+		shndx = calloc(symbol_size + 1, 4);
+	}
+
+	elf_sections[sym].data = symbol_table_write(&n_local_symb, &n_symb, shndx);
+	elf_sections[sym].size = n_symb * 24;
 	elf_sections[sym].header.sh_info = n_local_symb;
 
+	if (shndx) {
+		elf_sections[symtab_shndx].data = (uint8_t *)shndx;
+		elf_sections[symtab_shndx].size = n_symb * 4;
+		elf_sections[symtab_shndx].header.sh_link = sym;
+		elf_sections[symtab_shndx].header.sh_entsize = 4;
+		elf_sections[symtab_shndx].header.sh_addralign = 4;
+	}
+
 	for (unsigned i = 0; i < section_size; i++) {
 		struct section *section = sections + i;
 		if (!section->rela_size)
 			continue;
 
-		char buffer[256];
-		sprintf(buffer, ".rela%s", section->name);
-		int rela_id = elf_add_section(register_shstring(buffer), SHT_RELA);
+		char *name = malloc(strlen(section->name) + 6);
+		sprintf(name, ".rela%s", section->name);
+		int rela_id = elf_add_section(register_shstring(name), SHT_RELA);
+		free(name);
 		elf_sections[rela_id].size = 24 * section->rela_size;
 		elf_sections[rela_id].data = rela_write(section);
 		elf_sections[rela_id].header.sh_link = sym;
 		elf_sections[rela_id].header.sh_info = section->sh_idx;
 		elf_sections[rela_id].header.sh_entsize = 24;
+		elf_sections[rela_id].header.sh_addralign = 8;
 		elf_sections[rela_id].header.sh_flags = SHF_INFO_LINK;
 	}
 
@@ -460,15 +1815,27 @@ void elf_finish(const char *path) {
 
 	elf_sections[sym].header.sh_link = strtab_section;
 
-	elf_sections[shstrtab_section].size = shstring_size;
-	elf_sections[shstrtab_section].data = (uint8_t *)shstrings;
+	elf_sections[strtab_section].header.sh_addralign = 1;
+	elf_sections[shstrtab_section].header.sh_addralign = 1;
+
+	string_table_build(&shstrtab);
+	for (unsigned i = 0; i < elf_section_size; i++)
+		elf_sections[i].header.sh_name = string_table_offset(&shstrtab, elf_sections[i].header.sh_name);
+
+	elf_sections[shstrtab_section].size = shstrtab.data_size;
+	elf_sections[shstrtab_section].data = (uint8_t *)shstrtab.data;
+
+	elf_sections[strtab_section].size = strtab.data_size;
+	elf_sections[strtab_section].data = (uint8_t *)strtab.data;
 
-	elf_sections[strtab_section].size = string_size;
-	elf_sections[strtab_section].data = (uint8_t *)strings;
+	if (elf_section_size >= SHN_LORESERVE)
+		elf_sections[null_section].size = elf_section_size;
+	if (shstrtab_section >= SHN_LORESERVE)
+		elf_sections[null_section].header.sh_link = shstrtab_section;
 
 	allocate_sections();
 	write_header(shstrtab_section);
 	write_section_headers();
-	fclose(output);
+	output_write(path);
 }
 
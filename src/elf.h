@@ -19,16 +19,56 @@ enum {
 	R_X86_64_16 = 12, /* Direct 16 bit zero extended */
 	R_X86_64_PC16 = 13, /* 16 bit sign extended pc relative */
 	R_X86_64_8 = 14, /* Direct 8 bit sign extended  */
+	R_X86_64_PC8 = 15, /* 8 bit sign extended pc relative */
+	R_X86_64_DTPMOD64 = 16, /* ID of module containing symbol */
+	R_X86_64_DTPOFF64 = 17, /* Offset in module's TLS block */
+	R_X86_64_TPOFF64 = 18, /* Offset in initial TLS block */
+	R_X86_64_TLSGD = 19, /* 32 bit signed PC relative offset to two GOT entries for GD symbol */
+	R_X86_64_TLSLD = 20, /* 32 bit signed PC relative offset to two GOT entries for LD symbol */
+	R_X86_64_DTPOFF32 = 21, /* Offset in TLS block */
+	R_X86_64_GOTTPOFF = 22, /* 32 bit signed PC relative offset to GOT entry for IE symbol */
+	R_X86_64_TPOFF32 = 23, /* Offset in initial TLS block */
+	R_X86_64_PC64 = 24, /* PC relative 64 bit */
+};
+
+enum {
+	STV_DEFAULT = 0, /* Default symbol visibility rules */
+	STV_INTERNAL = 1, /* Processor specific hidden class */
+	STV_HIDDEN = 2, /* Sym unavailable in other modules */
+	STV_PROTECTED = 3, /* Not preemptible, not exported */
 };
 
 void elf_init(void);
 void elf_set_section(const char *section);
+void elf_section_set_attributes(const char *flags, const char *type, uint64_t entsize);
+uint64_t elf_section_offset(void);
+int elf_current_section(void);
+uint64_t elf_section_end(int section);
+int elf_symbol_location(const char *name, uint64_t *value);
+int elf_section_is_code(void);
+void elf_section_align(uint64_t alignment);
+void elf_mark_padding(uint64_t start);
+void elf_mark_terminator(void);
 void elf_write(uint8_t *data, int len);
 void elf_write_zero(int len);
 void elf_finish(const char *path);
 
-void elf_symbol_relocate_here(const char *name, int64_t offset, int type);
+void elf_symbol_relocate_here(const char *name, int64_t offset, int type, int64_t addend);
+void elf_symbol_difference_here(const char *name, const char *sub, int64_t offset, int size, int64_t addend);
 void elf_symbol_set_here(const char *name, int64_t offset);
 void elf_symbol_set_global(const char *name);
+void elf_symbol_set_type(const char *name, const char *type);
+void elf_symbol_set_size(const char *name, const char *add, const char *sub, int64_t value);
+void elf_symbol_set_visibility(const char *name, int visibility);
+void elf_symbol_set_address_significant(const char *name);
+void elf_symbol_set_local_common(const char *name, uint64_t size, uint64_t alignment);
+void elf_symbol_set_common(const char *name, uint64_t size, uint64_t alignment);
+
+void elf_fold_identical_functions(void);
+void elf_order_functions(const char **names, int n_names);
+void elf_split_sections(int code, int data);
+void elf_keep_local_labels(void);
+void elf_auto_size_symbols(void);
+void elf_keep_branch_alignment(void);
 
 #endif
@@ -1,6 +1,7 @@
 #include "encoder.h"
 #include "instructions.h"
 #include "parser.h"
+#include "elf.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,120 +27,114 @@ int get_disp_size(uint64_t disp_u) {
 void encode_sib(struct operand *o, int *rex_b, int *rex_x, int *modrm_mod, int *modrm_rm,
 				uint64_t *disp, int *has_disp8, int *has_disp32,
 				int *has_sib, int *sib_scale, int *sib_index, int *sib_base) {
-	int disp_size = get_disp_size(o->sib.offset);
-
-	// (%reg)
-	if (o->sib.index == REG_NONE && o->sib.base != REG_NONE &&
-		disp_size == 0) {
-		if (o->sib.base == REG_RSP ||
-			o->sib.base == REG_R12) {
-			*modrm_rm = 4;
-			*modrm_mod = 0;
-
-			*has_sib = 1;
-			*sib_index = 4;
-			*sib_base = 4;
-			if (o->sib.base == REG_R12)
-				*rex_b = 1;
-		} else if (o->sib.base == REG_RBP ||
-				   o->sib.base == REG_R13) {
-			*sib_index = 4;
-			*modrm_mod = 1;
-
-			*has_disp8 = 1;
-			*disp = 0;
-			*sib_base = 5;
-			if (o->sib.base == REG_R13)
-				*rex_b = 1;
-		} else {
-			*modrm_mod = 0;
+	*disp = o->sib.offset;
 
-			*modrm_rm = o->sib.base & 7;
-			*rex_b = (o->sib.base & 0x8) >> 3;
-		}
-	// disp8(%reg)
-	} else if (o->sib.index == REG_NONE && o->sib.base != REG_NONE &&
-			   disp_size <= 1) {
-		if (o->sib.base == REG_RSP ||
-			o->sib.base == REG_R12) {
-			*modrm_rm = 4;
-			*modrm_mod = 1;
-
-			*has_sib = 1;
-			*sib_index = 4;
-			*sib_base = 4;
-			if (o->sib.base == REG_R12)
-				*rex_b = 1;
-		} else {
-			*modrm_mod = 1;
-			*has_disp8 = 1;
+	if (o->sib.index == REG_RSP || o->sib.index == REG_RIP) {
+		parse_send_error("Invalid index register");
+		ERROR("Invalid index register %d", o->sib.index);
+	}
 
-			*modrm_rm = o->sib.base & 7;
-			*rex_b = (o->sib.base & 0x8) >> 3;
+	// disp32(%rip)
+	if (o->sib.base == REG_RIP) {
+		if (o->sib.index != REG_NONE) {
+			parse_send_error("%rip can not be used with an index register");
+			ERROR("Invalid use of %%rip");
 		}
 
-		*has_disp8 = 1;
-		*disp = o->sib.offset;
-	// disp32(%reg)
-	} else if (o->sib.index == REG_NONE && o->sib.base != REG_NONE &&
-			   disp_size <= 4) {
-		if (o->sib.base == REG_RSP ||
-			o->sib.base == REG_R12) {
-			*modrm_mod = 2;
+		*modrm_mod = 0;
+		*modrm_rm = 5;
+		*has_disp32 = 1;
+		return;
+	}
 
-			*has_sib = 1;
-			*sib_index = 4;
+	if (o->sib.index != REG_NONE) {
+		*rex_x = (o->sib.index & 0x8) >> 3;
+		*sib_index = o->sib.index & 7;
+	} else {
+		*sib_index = 4;
+	}
 
-			*modrm_rm = o->sib.base & 7;
-			*rex_b = (o->sib.base & 0x8) >> 3;
-		} else {
-			*modrm_mod = 2;
+	switch (o->sib.scale) {
+	case 1: *sib_scale = 0; break;
+	case 2: *sib_scale = 1; break;
+	case 4: *sib_scale = 2; break;
+	case 8: *sib_scale = 3; break;
+	default:
+		parse_send_error("Invalid scale");
+		ERROR("Invalid scale %d", o->sib.scale);
+	}
 
-			*disp = o->sib.offset;
+	// disp32 and disp32(, %index, scale) have no base, which is
+	// encoded as base 5 with mod 0.
+	if (o->sib.base == REG_NONE) {
+		*modrm_mod = 0;
+		*modrm_rm = 4;
+		*has_sib = 1;
+		*sib_base = 5;
+		*has_disp32 = 1;
+		return;
+	}
 
-			*modrm_rm = o->sib.base & 7;
-			*rex_b = (o->sib.base & 0x8) >> 3;
-		}
+	int disp_size = o->sib.str || o->sib.sub ? 4 : get_disp_size(o->sib.offset);
 
-		*has_disp32 = 1;
-		*disp = o->sib.offset;
-	// (%base, %scale, index)
-	} else if (o->sib.index != REG_NONE && o->sib.base != REG_NONE &&
-			   disp_size == 0) {
+	// %rbp and %r13 can not be encoded without displacement.
+	if (disp_size == 0 && (o->sib.base & 7) == REG_RBP)
+		disp_size = 1;
+
+	switch (disp_size) {
+	case 0: *modrm_mod = 0; break;
+	case 1: *modrm_mod = 1; *has_disp8 = 1; break;
+	case 4: *modrm_mod = 2; *has_disp32 = 1; break;
+	}
+
+	*rex_b = (o->sib.base & 0x8) >> 3;
+
+	// %rsp and %r12 as base can only be encoded with a SIB byte.
+	if (o->sib.index == REG_NONE && (o->sib.base & 7) != REG_RSP) {
+		*modrm_rm = o->sib.base & 7;
+	} else {
+		*modrm_rm = 4;
 		*has_sib = 1;
-		if (o->sib.index == REG_RSP) {
-			NOTIMP();
-		} else if (o->sib.base == REG_RBP ||
-				   o->sib.base == REG_R13) {
-			NOTIMP();
-		} else {
-			*modrm_rm = 4;
-				
-			*sib_base = o->sib.base & 7;
-			*rex_b = (o->sib.base & 0x8) >> 3;
+		*sib_base = o->sib.base & 7;
+	}
+}
 
-			*sib_index = o->sib.index & 7;
-			*rex_x = (o->sib.index & 0x8) >> 3;
+static int get_reloc_type(enum modifier modifier, int relative, int size) {
+	switch (modifier) {
+	case MOD_NONE:
+		if (relative)
+			return R_X86_64_PC32;
+		switch (size) {
+		case 1: return R_X86_64_8;
+		case 2: return R_X86_64_16;
+		case 4: return R_X86_64_32S;
+		case 8: return R_X86_64_64;
 		}
-	} else {
-		parse_send_error("Not implemented");
-		ERROR("Params: %d (%d, %d, %d)", disp_size, o->sib.base, o->sib.index, o->sib.scale);
+		break;
+	case MOD_PLT: return R_X86_64_PLT32;
+	case MOD_GOTPCREL: return R_X86_64_GOTPCREL;
+	case MOD_TPOFF: return R_X86_64_TPOFF32;
+	case MOD_GOTTPOFF: return R_X86_64_GOTTPOFF;
+	case MOD_TLSGD: return R_X86_64_TLSGD;
+	case MOD_TLSLD: return R_X86_64_TLSLD;
+	case MOD_DTPOFF: return R_X86_64_DTPOFF32;
 	}
 
-	// disp8(%base, %scale, index)
-	// disp32(%base, %scale, index)
+	ERROR("Invalid relocation");
 }
 
 //struct encoding cmp2 = {0x83, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}};
 
-void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, struct operand ops[4], char **reloc_name, int *reloc_offset, int *reloc_relative) {
+void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, const uint8_t *prefixes, int n_prefixes, struct operand ops[4], struct reloc relocs[2], int *n_relocs) {
 	int has_imm8 = 0, has_imm16 = 0, has_imm32 = 0, has_imm64 = 0;
 	uint64_t imm = 0;
-	char *imm_name = NULL;
-	*reloc_offset = 0;
-	*reloc_relative = 0;
+	char *imm_name = NULL, *imm_sub = NULL;
+	enum modifier imm_modifier = MOD_NONE;
+	struct operand *mem = NULL, absolute;
+	*n_relocs = 0;
 
 	int has_rex = encoding->rexw || encoding->rex;
+	int rex_w = encoding->rexw;
 	int rex_b = 0;
 	int rex_r = 0;
 	int rex_x = 0;
@@ -158,6 +153,7 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 	int sib_base = 0;
 
 	uint8_t op_ext = 0;
+	int vvvv = 0;
 
 	int has_rel32 = 0;
 	uint32_t rel = 0;
@@ -177,24 +173,32 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 			has_imm8 = 1;
 			imm = o->imm.value;
 			imm_name = o->imm.str;
+			imm_sub = o->imm.sub;
+			imm_modifier = o->imm.modifier;
 			break;
 
 		case OE_IMM16:
 			has_imm16 = 1;
 			imm = o->imm.value;
 			imm_name = o->imm.str;
+			imm_sub = o->imm.sub;
+			imm_modifier = o->imm.modifier;
 			break;
 
 		case OE_IMM32:
 			has_imm32 = 1;
 			imm = o->imm.value;
 			imm_name = o->imm.str;
+			imm_sub = o->imm.sub;
+			imm_modifier = o->imm.modifier;
 			break;
 
 		case OE_IMM64:
 			has_imm64 = 1;
 			imm = o->imm.value;
 			imm_name = o->imm.str;
+			imm_sub = o->imm.sub;
+			imm_modifier = o->imm.modifier;
 			break;
 
 		case OE_MODRM_RM:
@@ -205,18 +209,34 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 				modrm_mod = 3;
 
 				modrm_rm = o->reg.reg;
-				if (has_rex)
-					rex_b = (modrm_rm & 0x8) >> 3;
+				rex_b = (modrm_rm & 0x8) >> 3;
 				//modrm_rm = 
 				//NOTIMP();
 				break;
 
 			case O_SIB: {
+				mem = o;
 				encode_sib(o, &rex_b, &rex_x, &modrm_mod, &modrm_rm,
 						   &disp, &has_disp8, &has_disp32,
 						   &has_sib, &sib_scale, &sib_index, &sib_base);
 			} break;
 
+			case O_IMM_ABSOLUTE: {
+				// A bare symbol as memory operand is an absolute address.
+				absolute = (struct operand) {
+					.type = O_SIB,
+					.sib = {
+						.base = REG_NONE, .index = REG_NONE, .scale = 1,
+						.offset = o->imm.value, .str = o->imm.str, .sub = o->imm.sub,
+						.modifier = o->imm.modifier, .segment = REG_NONE,
+					},
+				};
+				mem = &absolute;
+				encode_sib(mem, &rex_b, &rex_x, &modrm_mod, &modrm_rm,
+						   &disp, &has_disp8, &has_disp32,
+						   &has_sib, &sib_scale, &sib_index, &sib_base);
+			} break;
+
 			default:
 				ERROR("Not imp: %d\n", o->type);
 				NOTIMP();
@@ -236,7 +256,12 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 			break;
 
 		case OE_OPEXT:
-			op_ext = o->reg.reg;
+			op_ext = o->reg.reg & 7;
+			rex_b = (o->reg.reg & 0x8) >> 3;
+			break;
+
+		case OE_VVVV:
+			vvvv = o->reg.reg;
 			break;
 
 		case OE_NONE:
@@ -249,6 +274,8 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 			has_rel32 = 1;
 			rel = o->imm.value;
 			imm_name = o->imm.str;
+			imm_sub = o->imm.sub;
+			imm_modifier = o->imm.modifier;
 			break;
 
 		default:
@@ -259,33 +286,87 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 			i--;
 	}
 
-	if (rex_b || rex_r) {
+	if (rex_b || rex_r || rex_x) {
 		has_rex = 1;
 	}
 
 	int idx = 0;
 
+	if (mem && mem->sib.segment == REG_FS)
+		output[idx++] = 0x64;
+	else if (mem && mem->sib.segment == REG_GS)
+		output[idx++] = 0x65;
+
 	if (encoding->op_size_prefix)
 		output[idx++] = 0x66;
 
-	if (has_rex) {
-		uint8_t rex_byte = 0x40;
+	// rex64 is merged into the REX prefix, which has to come last.
+	for (int i = 0; i < n_prefixes; i++) {
+		if (prefixes[i] == 0x48)
+			has_rex = rex_w = 1;
+		else
+			output[idx++] = prefixes[i];
+	}
 
-		if (encoding->rexw)
-			rex_byte |= 0x8;
+	if (encoding->vex) {
+		// The VEX prefix replaces REX, the mandatory prefix and the 0x0f escape bytes.
+		int map = 1;
+		uint8_t vex_opcode = encoding->op2;
+		if (encoding->op2 == 0x38 || encoding->op2 == 0x3a) {
+			map = encoding->op2 == 0x38 ? 2 : 3;
+			vex_opcode = encoding->op3;
+		}
 
-		rex_byte |= rex_b;
-		rex_byte |= rex_r << 2;
+		int pp = 0;
+		switch (encoding->prefix) {
+		case 0x66: pp = 1; break;
+		case 0xf3: pp = 2; break;
+		case 0xf2: pp = 3; break;
+		}
 
-		output[idx++] = rex_byte;
-	}
+		uint8_t vex_last = (~vvvv & 0xf) << 3 | pp;
+
+		if (map == 1 && !rex_x && !rex_b && !rex_w) {
+			output[idx++] = 0xc5;
+			output[idx++] = !rex_r << 7 | vex_last;
+		} else {
+			output[idx++] = 0xc4;
+			output[idx++] = !rex_r << 7 | !rex_x << 6 | !rex_b << 5 | map;
+			output[idx++] = !!rex_w << 7 | vex_last;
+		}
+
+		output[idx++] = vex_opcode | op_ext;
+	} else {
+		if (encoding->prefix)
+			output[idx++] = encoding->prefix;
 
-	output[idx++] = encoding->opcode | op_ext;
-	if (encoding->opcode == 0x0f) {
-		output[idx++] = encoding->op2;
-		if (encoding->op2 == 0x38 ||
-			encoding->op2 == 0x3a)
-			output[idx++] = encoding->op3;
+		if (has_rex) {
+			uint8_t rex_byte = 0x40;
+
+			if (rex_w)
+				rex_byte |= 0x8;
+
+			rex_byte |= rex_b;
+			rex_byte |= rex_x << 1;
+			rex_byte |= rex_r << 2;
+
+			output[idx++] = rex_byte;
+		}
+
+		// Register opcode extensions (OE_OPEXT) go into the last opcode byte.
+		if (encoding->opcode == 0x0f) {
+			output[idx++] = encoding->opcode;
+			if (encoding->op2 == 0x38 ||
+				encoding->op2 == 0x3a ||
+				encoding->op3) {
+				output[idx++] = encoding->op2;
+				output[idx++] = encoding->op3 | op_ext;
+			} else {
+				output[idx++] = encoding->op2 | op_ext;
+			}
+		} else {
+			output[idx++] = encoding->opcode | op_ext;
+		}
 	}
 
 	if (has_modrm) {
@@ -312,38 +393,155 @@ void assemble_encoding(uint8_t *output, int *len, struct encoding *encoding, str
 		output[idx] = (uint8_t)disp;
 		idx++;
 	} else if (has_disp32) {
+		if (mem->sib.str || mem->sib.sub) {
+			if (mem->sib.sub && mem->sib.base == REG_RIP) {
+				parse_send_error("Symbol difference can not be %rip relative");
+				ERROR("Invalid displacement");
+			}
+
+			relocs[(*n_relocs)++] = (struct reloc) {
+				.name = mem->sib.str,
+				.sub = mem->sib.sub,
+				.offset = idx,
+				.size = 4,
+				.type = get_reloc_type(mem->sib.modifier, mem->sib.base == REG_RIP, 4),
+				.relative = mem->sib.base == REG_RIP,
+				.addend = disp,
+			};
+			disp = 0;
+		}
 		*(uint32_t *)(output + idx) = disp;
 		idx += 4;
 	}
 
+	int imm_size = has_imm8 ? 1 : has_imm16 ? 2 : has_imm32 ? 4 : has_imm64 ? 8 : 0;
+	if (imm_size && (imm_name || imm_sub)) {
+		relocs[(*n_relocs)++] = (struct reloc) {
+			.name = imm_name,
+			.sub = imm_sub,
+			.offset = idx,
+			.size = imm_size,
+			.type = get_reloc_type(imm_modifier, 0, imm_size),
+			.addend = imm,
+		};
+		imm = 0;
+	}
+
 	if (has_imm8) {
 		output[idx] = (uint8_t)imm;
-		*reloc_offset = idx;
 		idx++;
 	} else if (has_imm16) {
 		*(uint16_t *)(output + idx) = imm;
-		*reloc_offset = idx;
 		idx += 2;
 	} else if (has_imm32) {
 		*(uint32_t *)(output + idx) = imm;
-		*reloc_offset = idx;
 		idx += 4;
 	} else if (has_imm64) {
 		*(uint64_t *)(output + idx) = imm;
-		*reloc_offset = idx;
 		idx += 8;
 	}
 
 	if (has_rel32) {
+		if (imm_sub) {
+			parse_send_error("Branch target can not be a symbol difference");
+			ERROR("Invalid branch target");
+		}
+
+		if (imm_name) {
+			relocs[(*n_relocs)++] = (struct reloc) {
+				.name = imm_name,
+				.offset = idx,
+				.size = 4,
+				.type = get_reloc_type(imm_modifier, 1, 4),
+				.relative = 1,
+				.addend = rel,
+			};
+			rel = 0;
+		}
 		*(uint32_t *)(output + idx) = rel;
-		*reloc_offset = idx;
-		*reloc_relative = 1;
 		idx += 4;
 	}
 
 	*len = idx;
 
-	*reloc_name = imm_name;
+	// PC relative relocations are relative to the end of the instruction.
+	for (int i = 0; i < *n_relocs; i++)
+		if (relocs[i].relative)
+			relocs[i].addend -= idx - relocs[i].offset;
+}
+
+// Writes a single NOP of len bytes, 1 <= len <= 11.
+// These are the sequences recommended by the optimization manuals.
+void assemble_nop(uint8_t *output, int len) {
+	static const uint8_t nops[11][11] = {
+		{ 0x90 },
+		{ 0x66, 0x90 },
+		{ 0x0f, 0x1f, 0x00 },
+		{ 0x0f, 0x1f, 0x40, 0x00 },
+		{ 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+		{ 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+		{ 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	};
+
+	assert(len >= 1 && len <= 11);
+	memcpy(output, nops[len - 1], len);
+}
+
+// 64-bit operations on registers that can be done as 32-bit operations,
+// which need no REX.W prefix. Writes to 32-bit registers zero the upper half,
+// so this is only done where the 64-bit result has a zero upper half,
+// and the flags are the same.
+static const struct narrowing {
+	const char *from, *to;
+	enum {
+		N_UIMM32, // Immediate that zero extends to the same value.
+		N_POSITIVE_IMM32, // Positive immediate, the upper half of the result is zero.
+		N_SAME_REG // Zeroing idiom, %r op %r.
+	} source;
+} narrowings[] = {
+	{ "movq", "movl", N_UIMM32 },
+	{ "andq", "andl", N_POSITIVE_IMM32 },
+	{ "xor", "xorl", N_SAME_REG },
+	{ "xorq", "xorl", N_SAME_REG },
+	{ "subq", "subl", N_SAME_REG },
+};
+
+// Operands are in Intel order.
+void narrow_instruction(const char **mnemonic, struct operand ops[4]) {
+	for (unsigned i = 0; i < sizeof narrowings / sizeof *narrowings; i++) {
+		const struct narrowing *n = narrowings + i;
+		if (strcmp(n->from, *mnemonic) != 0)
+			continue;
+
+		struct operand *dest = ops + 0, *src = ops + 1;
+		if (dest->type != O_REG || dest->reg.size != 8 || ops[2].type != O_EMPTY)
+			return;
+
+		int constant = src->type == O_IMM && !src->imm.str && !src->imm.sub;
+		switch (n->source) {
+		case N_UIMM32:
+			if (!constant || src->imm.value > UINT32_MAX)
+				return;
+			break;
+		case N_POSITIVE_IMM32:
+			if (!constant || src->imm.value > INT32_MAX)
+				return;
+			break;
+		case N_SAME_REG:
+			if (src->type != O_REG || src->reg.reg != dest->reg.reg || src->reg.size != 8)
+				return;
+			src->reg.size = 4;
+			break;
+		}
+
+		*mnemonic = n->to;
+		dest->reg.size = 4;
+		return;
+	}
 }
 
 int does_match(struct operand *o, struct operand_accepts *oa) {
@@ -392,7 +590,7 @@ int does_match(struct operand *o, struct operand_accepts *oa) {
 		if (s < INT8_MIN || s > INT8_MAX)
 			return 0;
 
-		if (o->imm.str)
+		if (o->imm.str || o->imm.sub)
 			return 0;
 	} break;
 
@@ -403,7 +601,7 @@ int does_match(struct operand *o, struct operand_accepts *oa) {
 		if (s < INT16_MIN || s > INT16_MAX)
 			return 0;
 
-		if (o->imm.str)
+		if (o->imm.str || o->imm.sub)
 			return 0;
 	} break;
 
@@ -423,11 +621,11 @@ int does_match(struct operand *o, struct operand_accepts *oa) {
 	} break;
 
 	case ACC_MODRM:
-		// Either accept register of correct size or SIB.
+		// Either accept register of correct size or memory.
 		if (o->type == O_REG) {
 			if (o->reg.size != oa->reg.size)
 				return 0;
-		} else if (o->type == O_SIB) {
+		} else if (o->type == O_SIB || o->type == O_IMM_ABSOLUTE) {
 		} else {
 			return 0;
 		}
@@ -438,6 +636,11 @@ int does_match(struct operand *o, struct operand_accepts *oa) {
 			return 0;
 		break;
 
+	case ACC_MEM:
+		if (o->type != O_SIB && o->type != O_IMM_ABSOLUTE)
+			return 0;
+		break;
+
 	case ACC_REL32:
 		if (o->type != O_IMM_ABSOLUTE)
 			return 0;
@@ -450,12 +653,30 @@ int does_match(struct operand *o, struct operand_accepts *oa) {
 	return 1;
 }
 
-void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, struct operand ops[4], char **reloc_name, int *reloc_offset, int *reloc_relative) {
+// Only read-modify-write instructions can be locked, and only when their
+// destination, the ModRM r/m operand, is in memory.
+static int can_lock(struct encoding *encoding, struct operand ops[4]) {
+	if (!encoding->lockable)
+		return 0;
+
+	for (int i = 0; i < 4; i++) {
+		if (encoding->operand_encoding[i].type == OE_MODRM_RM)
+			return ops[i].type == O_SIB || ops[i].type == O_IMM_ABSOLUTE;
+	}
+	return 0;
+}
+
+void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, const uint8_t *prefixes, int n_prefixes, struct operand ops[4], struct reloc relocs[2], int *n_relocs) {
 	int best_len = 16;
 	uint8_t best_output[15] = { 0 };
-	char *best_name = NULL;
-	int best_offset = 0;
-	int best_relative = 0;
+	struct reloc best_relocs[2];
+	int best_n_relocs = 0;
+
+	int locked = 0;
+	for (int i = 0; i < n_prefixes; i++)
+		locked |= prefixes[i] == 0xf0;
+	int matched = 0;
+
 	// TODO: Just order the instructions in such a way that we can just take the first one that appears.
 	for (unsigned i = 0; i < sizeof encodings / sizeof *encodings; i++) {
 		struct encoding *encoding = encodings + i;
@@ -477,23 +698,30 @@ void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, struc
 		if (!matches)
 			continue;
 
+		matched = 1;
+		if (locked && !can_lock(encoding, ops))
+			continue;
+
 		//printf("Matched %d\n", i);
 		uint8_t current_output[15];
 		int current_len;
-		char *current_reloc_name = NULL;
-		int current_reloc_offset = 0;
-		int current_reloc_relative = 0;
-		assemble_encoding(current_output, &current_len, encoding, ops, &current_reloc_name, &current_reloc_offset, &current_reloc_relative);
+		struct reloc current_relocs[2];
+		int current_n_relocs = 0;
+		assemble_encoding(current_output, &current_len, encoding, prefixes, n_prefixes, ops, current_relocs, &current_n_relocs);
 
 		if (current_len < best_len) {
 			memcpy(best_output, current_output, sizeof (best_output));
 			best_len = current_len;
-			best_name = current_reloc_name;
-			best_offset = current_reloc_offset;
-			best_relative = current_reloc_relative;
+			memcpy(best_relocs, current_relocs, sizeof (best_relocs));
+			best_n_relocs = current_n_relocs;
 		}
 	}
 
+	if (best_len == 16 && locked && matched) {
+		parse_send_error("lock prefix requires a read-modify-write instruction with a memory destination");
+		ERROR("Invalid lock prefix on %s", mnemonic);
+	}
+
 	if (best_len == 16) {
 		*len = -1;
 		return;
@@ -501,7 +729,6 @@ void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, struc
 
 	*len = best_len;
 	memcpy(output, best_output, sizeof (best_output));
-	*reloc_name = best_name;
-	*reloc_offset = best_offset;
-	*reloc_relative = best_relative;
+	memcpy(relocs, best_relocs, sizeof (best_relocs));
+	*n_relocs = best_n_relocs;
 }
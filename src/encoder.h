@@ -7,6 +7,17 @@
 
 #include <stdint.h>
 
-void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, struct operand ops[4], char **reloc_name, int *reloc_offset, int *reloc_relative);
+struct reloc {
+	char *name, *sub; // name - sub + addend
+	int offset; // Offset into the instruction.
+	int size;
+	int type; // R_X86_64_*, unused for differences.
+	int relative;
+	int64_t addend;
+};
+
+void narrow_instruction(const char **mnemonic, struct operand ops[4]);
+void assemble_nop(uint8_t *output, int len);
+void assemble_instruction(uint8_t *output, int *len, const char *mnemonic, const uint8_t *prefixes, int n_prefixes, struct operand ops[4], struct reloc relocs[2], int *n_relocs);
 
 #endif
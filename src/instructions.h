@@ -21,7 +21,8 @@ struct operand_encoding {
 		OE_REL8,
 		OE_REL16,
 		OE_REL32,
-		OE_OPEXT
+		OE_OPEXT,
+		OE_VVVV
 	} type;
 
 	int duplicate;
@@ -44,7 +45,8 @@ struct operand_accepts {
 		ACC_REL8,
 		ACC_REL16,
 		ACC_REL32,
-		ACC_MODRM
+		ACC_MODRM,
+		ACC_MEM
 	} type;
 
 	union {
@@ -67,6 +69,7 @@ struct operand_accepts {
 #define A_REG_STAR(SIZE) {.type = ACC_REG_STAR, .reg.size = SIZE }
 #define A_RAX(SIZE) {.type = ACC_RAX, .reg.size = SIZE }
 #define A_RCX(SIZE) {.type = ACC_RCX, .reg.size = SIZE }
+#define A_MEM {.type = ACC_MEM }
 
 struct encoding {
 	const char *mnemonic;
@@ -76,34 +79,55 @@ struct encoding {
 	int modrm_extension;
 	int slash_r;
 	int op_size_prefix;
+	uint8_t prefix; // Mandatory prefix (0x66, 0xf3 or 0xf2), becomes VEX.pp if vex is set.
+	int vex;
+	int lockable; // Can take a lock prefix if the ModRM r/m operand is memory.
 	struct operand_encoding operand_encoding[4];
 	struct operand_accepts operand_accepts[4];
 };
 
 #define MR {{OE_MODRM_RM}, {OE_MODRM_REG}}
+#define RM {{OE_MODRM_REG}, {OE_MODRM_RM}}
 
 struct encoding encodings[] = {
 	// ADDQ
 	{"addq", 0x05, .rex = 1, .rexw = 1, .operand_encoding = {{OE_NONE}, {OE_IMM32}}, .operand_accepts = {A_RAX(8), A_IMM32_S}},
 	{"addq", 0x04, .operand_encoding = {{OE_NONE}, {OE_IMM8}}, .operand_accepts = {A_REG(4), A_IMM8_S}},
-	{"addq", 0x83, .rex = 1, .rexw = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_REG(8), A_IMM8_S}},
-	{"addq", 0x01, .rex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
-
-	{"subq", 0x83, .rex = 1, .rexw = 1, .modrm_extension = 5, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_MODRM(8), A_IMM8_S}},
-	{"subq", 0x81, .rex = 1, .rexw = 1, .modrm_extension = 5, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(8), A_IMM32_S}},
-	{"subq", 0x29, .rex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(8), A_REG(8)}},
-	{"subl", 0x29, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(4), A_REG(4)}},
-
-	{"andl", 0x21, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
-	{"andq", 0x21, .rex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
-	{"andq", 0x83, .rex = 1, .rexw = 1, .modrm_extension = 4, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_REG(8), A_IMM8_S}},
-
-	{"orl", 0x09, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
-	{"orq", 0x09, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
-
-	{"xor", 0x31, .rex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
-	{"xorq", 0x31, .rex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
-	{"xorl", 0x31, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
+	{"addq", 0x83, .rex = 1, .rexw = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_MODRM(8), A_IMM8_S}},
+	{"addq", 0x81, .rex = 1, .rexw = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(8), A_IMM32_S}},
+	{"addq", 0x01, .rex = 1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+	{"addl", 0x05, .operand_encoding = {{OE_NONE}, {OE_IMM32}}, .operand_accepts = {A_RAX(4), A_IMM32_S}},
+	{"addl", 0x83, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_MODRM(4), A_IMM8_S}},
+	{"addl", 0x81, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(4), A_IMM32_S}},
+	{"addl", 0x01, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(4), A_REG(4)}},
+
+	{"incl", 0xff, .modrm_extension = 0, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
+	{"incq", 0xff, .rexw = 1, .modrm_extension = 0, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
+	{"decl", 0xff, .modrm_extension = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
+	{"decq", 0xff, .rexw = 1, .modrm_extension = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
+
+	{"subq", 0x83, .rex = 1, .rexw = 1, .modrm_extension = 5, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_MODRM(8), A_IMM8_S}},
+	{"subq", 0x81, .rex = 1, .rexw = 1, .modrm_extension = 5, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(8), A_IMM32_S}},
+	{"subq", 0x29, .rex = 1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+	{"subl", 0x29, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(4), A_REG(4)}},
+
+	{"andl", 0x21, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
+	{"andq", 0x21, .rex = 1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
+	{"andq", 0x83, .rex = 1, .rexw = 1, .modrm_extension = 4, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_REG(8), A_IMM8_S}},
+	{"andq", 0x25, .rex = 1, .rexw = 1, .operand_encoding = {{OE_NONE}, {OE_IMM32}}, .operand_accepts = {A_RAX(8), A_IMM32_S}},
+	{"andq", 0x81, .rex = 1, .rexw = 1, .modrm_extension = 4, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(8), A_IMM32_S}},
+	{"andl", 0x83, .modrm_extension = 4, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_MODRM(4), A_IMM8_S}},
+	{"andl", 0x25, .operand_encoding = {{OE_NONE}, {OE_IMM32}}, .operand_accepts = {A_RAX(4), A_IMM32}},
+	{"andl", 0x81, .modrm_extension = 4, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(4), A_IMM32}},
+	{"andl", 0x25, .operand_encoding = {{OE_NONE}, {OE_IMM32}}, .operand_accepts = {A_RAX(4), A_IMM32_S}},
+	{"andl", 0x81, .modrm_extension = 4, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_IMM32}}, .operand_accepts = {A_MODRM(4), A_IMM32_S}},
+
+	{"orl", 0x09, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
+	{"orq", 0x09, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
+
+	{"xor", 0x31, .rex = 1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
+	{"xorq", 0x31, .rex = 1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(8), A_REG(8)}},
+	{"xorl", 0x31, .slash_r = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_REG(4), A_REG(4)}},
 
 	{"divl", 0xf7, .modrm_extension = 6, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
 	{"divq", 0xf7, .rexw = 1, .modrm_extension = 6, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
@@ -118,6 +142,7 @@ struct encoding encodings[] = {
 	{"imull", 0x0f, .op2 = 0xaf, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_MODRM(4)}},
 
 	{"callq", 0xff, .modrm_extension = 2, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_REG_STAR(8)}},
+	{"callq", 0xe8, .operand_encoding = {{OE_REL32}}, .operand_accepts = {A_REL32}},
 	{ "cltd", .opcode = 0x99 },
 	{ "cqto", .rexw = 1, .opcode = 0x99 },
 	{ "leave", .opcode = 0xc9 },
@@ -163,12 +188,13 @@ struct encoding encodings[] = {
 	{"movzbl", 0x0f, .op2 = 0xb6, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_MODRM(1)}},
 
 	{"pushq", 0x50, .operand_encoding = {{OE_OPEXT}}, .operand_accepts = {A_REG(8)}},
+	{"popq", 0x58, .operand_encoding = {{OE_OPEXT}}, .operand_accepts = {A_REG(8)}},
 
-	{"notl", 0xf7, .modrm_extension = 2, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
-	{"notq", 0xf7, .rex = 1, .rexw = 1, .modrm_extension = 2, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
+	{"notl", 0xf7, .modrm_extension = 2, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
+	{"notq", 0xf7, .rex = 1, .rexw = 1, .modrm_extension = 2, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
 
-	{"negl", 0xf7, .modrm_extension = 3, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
-	{"negq", 0xf7, .rexw = 1, .modrm_extension = 3, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
+	{"negl", 0xf7, .modrm_extension = 3, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(4)}},
+	{"negq", 0xf7, .rexw = 1, .modrm_extension = 3, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(8)}},
 
 	{"seta", 0x0f, .op2 = 0x97, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(1)}},
 	{"setb", 0x0f, .op2 = 0x92, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MODRM(1)}},
@@ -194,6 +220,102 @@ struct encoding encodings[] = {
 	{"testb", 0x84, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(1), A_REG(1)}},
 	{"testl", 0x85, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(4), A_REG(4)}},
 	{"testq", 0x85, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_RM}, {OE_MODRM_REG}}, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+
+	// Atomics, usually with a lock prefix.
+	{"cmpxchgb", 0x0f, .op2 = 0xb0, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(1), A_REG(1)}},
+	{"cmpxchgw", 0x0f, .op2 = 0xb1, .op_size_prefix = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(2), A_REG(2)}},
+	{"cmpxchgl", 0x0f, .op2 = 0xb1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(4), A_REG(4)}},
+	{"cmpxchgq", 0x0f, .op2 = 0xb1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+	{"cmpxchg8b", 0x0f, .op2 = 0xc7, .modrm_extension = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MEM}},
+	{"cmpxchg16b", 0x0f, .op2 = 0xc7, .rexw = 1, .modrm_extension = 1, .lockable = 1, .operand_encoding = {{OE_MODRM_RM}}, .operand_accepts = {A_MEM}},
+
+	{"xaddb", 0x0f, .op2 = 0xc0, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(1), A_REG(1)}},
+	{"xaddw", 0x0f, .op2 = 0xc1, .op_size_prefix = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(2), A_REG(2)}},
+	{"xaddl", 0x0f, .op2 = 0xc1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(4), A_REG(4)}},
+	{"xaddq", 0x0f, .op2 = 0xc1, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+
+	{"xchgb", 0x86, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(1), A_REG(1)}},
+	{"xchgb", 0x86, .slash_r = 1, .lockable = 1, .operand_encoding = RM, .operand_accepts = {A_REG(1), A_MODRM(1)}},
+	{"xchgw", 0x87, .op_size_prefix = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(2), A_REG(2)}},
+	{"xchgw", 0x87, .op_size_prefix = 1, .slash_r = 1, .lockable = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"xchgl", 0x87, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(4), A_REG(4)}},
+	{"xchgl", 0x87, .slash_r = 1, .lockable = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"xchgq", 0x87, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = MR, .operand_accepts = {A_MODRM(8), A_REG(8)}},
+	{"xchgq", 0x87, .rexw = 1, .slash_r = 1, .lockable = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+
+	{ "mfence", .opcode = 0x0f, .op2 = 0xae, .op3 = 0xf0 },
+	{ "lfence", .opcode = 0x0f, .op2 = 0xae, .op3 = 0xe8 },
+	{ "sfence", .opcode = 0x0f, .op2 = 0xae, .op3 = 0xf8 },
+	{ "pause", .opcode = 0x90, .prefix = 0xf3 },
+
+	// String instructions, usually with a rep prefix.
+	{ "movsb", .opcode = 0xa4 },
+	{ "movsw", .opcode = 0xa5, .op_size_prefix = 1 },
+	{ "movsl", .opcode = 0xa5 },
+	{ "movsq", .opcode = 0xa5, .rexw = 1 },
+	{ "stosb", .opcode = 0xaa },
+	{ "stosw", .opcode = 0xab, .op_size_prefix = 1 },
+	{ "stosl", .opcode = 0xab },
+	{ "stosq", .opcode = 0xab, .rexw = 1 },
+	{ "lodsb", .opcode = 0xac },
+	{ "lodsw", .opcode = 0xad, .op_size_prefix = 1 },
+	{ "lodsl", .opcode = 0xad },
+	{ "lodsq", .opcode = 0xad, .rexw = 1 },
+	{ "cmpsb", .opcode = 0xa6 },
+	{ "cmpsw", .opcode = 0xa7, .op_size_prefix = 1 },
+	{ "cmpsl", .opcode = 0xa7 },
+	{ "cmpsq", .opcode = 0xa7, .rexw = 1 },
+	{ "scasb", .opcode = 0xae },
+	{ "scasw", .opcode = 0xaf, .op_size_prefix = 1 },
+	{ "scasl", .opcode = 0xaf },
+	{ "scasq", .opcode = 0xaf, .rexw = 1 },
+
+	// Bit scan and count.
+	{"bsfw", 0x0f, .op2 = 0xbc, .op_size_prefix = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"bsfl", 0x0f, .op2 = 0xbc, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"bsfq", 0x0f, .op2 = 0xbc, .rexw = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+	{"bsrw", 0x0f, .op2 = 0xbd, .op_size_prefix = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"bsrl", 0x0f, .op2 = 0xbd, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"bsrq", 0x0f, .op2 = 0xbd, .rexw = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+
+	{"tzcntw", 0x0f, .op2 = 0xbc, .prefix = 0xf3, .op_size_prefix = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"tzcntl", 0x0f, .op2 = 0xbc, .prefix = 0xf3, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"tzcntq", 0x0f, .op2 = 0xbc, .prefix = 0xf3, .rexw = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+	{"lzcntw", 0x0f, .op2 = 0xbd, .prefix = 0xf3, .op_size_prefix = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"lzcntl", 0x0f, .op2 = 0xbd, .prefix = 0xf3, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"lzcntq", 0x0f, .op2 = 0xbd, .prefix = 0xf3, .rexw = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+	{"popcntw", 0x0f, .op2 = 0xb8, .prefix = 0xf3, .op_size_prefix = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(2), A_MODRM(2)}},
+	{"popcntl", 0x0f, .op2 = 0xb8, .prefix = 0xf3, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"popcntq", 0x0f, .op2 = 0xb8, .prefix = 0xf3, .rexw = 1, .slash_r = 1, .operand_encoding = RM, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+
+	{"bswapl", 0x0f, .op2 = 0xc8, .operand_encoding = {{OE_OPEXT}}, .operand_accepts = {A_REG(4)}},
+	{"bswapq", 0x0f, .op2 = 0xc8, .rexw = 1, .operand_encoding = {{OE_OPEXT}}, .operand_accepts = {A_REG(8)}},
+
+	// BMI1 and BMI2, these are all VEX encoded.
+	{"andnl", 0x0f, .op2 = 0x38, .op3 = 0xf2, .vex = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_REG(4), A_MODRM(4)}},
+	{"andnq", 0x0f, .op2 = 0x38, .op3 = 0xf2, .vex = 1, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_REG(8), A_MODRM(8)}},
+
+	{"blsrl", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .modrm_extension = 1, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"blsrq", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .rexw = 1, .modrm_extension = 1, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+	{"blsmskl", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .modrm_extension = 2, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"blsmskq", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .rexw = 1, .modrm_extension = 2, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+	{"blsil", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .modrm_extension = 3, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_MODRM(4)}},
+	{"blsiq", 0x0f, .op2 = 0x38, .op3 = 0xf3, .vex = 1, .rexw = 1, .modrm_extension = 3, .operand_encoding = {{OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_MODRM(8)}},
+
+	{"shlxl", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0x66, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(4), A_MODRM(4), A_REG(4)}},
+	{"shlxq", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0x66, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(8), A_MODRM(8), A_REG(8)}},
+	{"shrxl", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0xf2, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(4), A_MODRM(4), A_REG(4)}},
+	{"shrxq", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0xf2, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(8), A_MODRM(8), A_REG(8)}},
+	{"sarxl", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0xf3, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(4), A_MODRM(4), A_REG(4)}},
+	{"sarxq", 0x0f, .op2 = 0x38, .op3 = 0xf7, .vex = 1, .prefix = 0xf3, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_VVVV}}, .operand_accepts = {A_REG(8), A_MODRM(8), A_REG(8)}},
+
+	{"pdepl", 0x0f, .op2 = 0x38, .op3 = 0xf5, .vex = 1, .prefix = 0xf2, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_REG(4), A_MODRM(4)}},
+	{"pdepq", 0x0f, .op2 = 0x38, .op3 = 0xf5, .vex = 1, .prefix = 0xf2, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_REG(8), A_MODRM(8)}},
+	{"pextl", 0x0f, .op2 = 0x38, .op3 = 0xf5, .vex = 1, .prefix = 0xf3, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(4), A_REG(4), A_MODRM(4)}},
+	{"pextq", 0x0f, .op2 = 0x38, .op3 = 0xf5, .vex = 1, .prefix = 0xf3, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_VVVV}, {OE_MODRM_RM}}, .operand_accepts = {A_REG(8), A_REG(8), A_MODRM(8)}},
+
+	{"rorxl", 0x0f, .op2 = 0x3a, .op3 = 0xf0, .vex = 1, .prefix = 0xf2, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_REG(4), A_MODRM(4), A_IMM8_S}},
+	{"rorxq", 0x0f, .op2 = 0x3a, .op3 = 0xf0, .vex = 1, .prefix = 0xf2, .rexw = 1, .slash_r = 1, .operand_encoding = {{OE_MODRM_REG}, {OE_MODRM_RM}, {OE_IMM8}}, .operand_accepts = {A_REG(8), A_MODRM(8), A_IMM8_S}},
 };
 
 #endif
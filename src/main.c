@@ -1,6 +1,9 @@
 #include "parser.h"
 #include "encoder.h"
 #include "elf.h"
+#include "peephole.h"
+#include "dwarf.h"
+#include "darray.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,14 +69,293 @@ void write_escaped_string(const char *str) {
 	elf_write(buffer, i);
 }
 
+// "." refers to the current position, which is given a temporary label.
+void resolve_dot(char **name) {
+	static int dot_counter = 0;
+	if (!*name || strcmp(*name, ".") != 0)
+		return;
+
+	char buffer[32];
+	sprintf(buffer, ".L.dot.%d", dot_counter++);
+	*name = strdup(buffer);
+	elf_symbol_set_here(*name, 0);
+}
+
+void resolve_expression_dot(struct expression *expr) {
+	resolve_dot(&expr->str);
+	resolve_dot(&expr->sub);
+}
+
+void write_expression(struct expression *expr, int size) {
+	resolve_expression_dot(expr);
+
+	uint64_t value = expr->value;
+	if (expr->sub) {
+		if (!expr->str)
+			ERROR("Can not negate symbol %s", expr->sub);
+		elf_symbol_difference_here(expr->str, expr->sub, 0, size, value);
+		value = 0;
+	} else if (expr->str) {
+		int type = size == 8 ? R_X86_64_64 : size == 4 ? R_X86_64_32 :
+			size == 2 ? R_X86_64_16 : R_X86_64_8;
+		elf_symbol_relocate_here(expr->str, 0, type, value);
+		value = 0;
+	}
+
+	elf_write((uint8_t *)&value, size);
+}
+
+void write_nops(uint64_t padding) {
+	while (padding > 0) {
+		uint8_t nop[11];
+		int len = padding > sizeof nop ? sizeof nop : padding;
+		assemble_nop(nop, len);
+		elf_write(nop, len);
+		padding -= len;
+	}
+}
+
+// Code is padded with the longest NOPs possible, data with the fill value.
+void align(uint64_t alignment, int has_fill, uint8_t fill, uint64_t max) {
+	if (alignment == 0 || (alignment & (alignment - 1)))
+		ERROR("Alignment %lu is not a power of two", alignment);
+
+	elf_section_align(alignment);
+
+	uint64_t start = elf_section_offset();
+	uint64_t padding = -start & (alignment - 1);
+	if (max && padding > max)
+		return;
+
+	if (has_fill || !elf_section_is_code()) {
+		for (uint64_t i = 0; i < padding; i++)
+			elf_write(&fill, 1);
+	} else {
+		write_nops(padding);
+	}
+
+	elf_mark_padding(start);
+}
+
+struct encoded {
+	uint8_t output[15];
+	int len;
+	struct reloc relocs[2];
+	int n_relocs;
+	int terminator; // Control never continues after it.
+};
+
+void write_encoded(struct encoded *e) {
+	dwarf_instruction();
+
+	for (int i = 0; i < e->n_relocs; i++) {
+		struct reloc *r = e->relocs + i;
+		if (r->sub)
+			elf_symbol_difference_here(r->name, r->sub, r->offset, r->size, r->addend);
+		else
+			elf_symbol_relocate_here(r->name, r->offset, r->type, r->addend);
+	}
+
+	elf_write(e->output, e->len);
+	if (e->terminator)
+		elf_mark_terminator();
+}
+
+// Mitigation for the Intel JCC erratum (like -mbranches-within-32B-boundaries
+// in GNU as). Jumps, calls, returns and macro-fused cmp/test+jcc pairs
+// are padded with NOPs so that they neither cross nor end on a 32 byte boundary.
+static int align_branches = 0;
+static uint64_t branch_padding = 0;
+
+static struct encoded fusible;
+static int has_fusible = 0;
+
+int is_jcc(const char *mnemonic) {
+	return mnemonic[0] == 'j' && strcmp(mnemonic, "jmp") != 0;
+}
+
+int is_terminator(const char *mnemonic) {
+	return strcmp(mnemonic, "jmp") == 0 || strcmp(mnemonic, "ret") == 0 ||
+		strcmp(mnemonic, "ud2") == 0;
+}
+
+int is_branch(const char *mnemonic) {
+	return mnemonic[0] == 'j' || strcmp(mnemonic, "callq") == 0 ||
+		strcmp(mnemonic, "ret") == 0;
+}
+
+// Instructions that can macro-fuse with a following jcc.
+// Memory operands combined with immediates never fuse.
+int is_fusible(struct instruction *instruction) {
+	static const char *fusible_mnemonics[] = {
+		"cmpb", "cmpw", "cmpl", "cmpq", "testb", "testw", "testl", "testq",
+		"addl", "addq", "subl", "subq", "andl", "andq",
+		"incl", "incq", "decl", "decq",
+	};
+
+	int has_mem = 0, has_imm = 0;
+	for (int i = 0; i < 4; i++) {
+		int type = instruction->operands[i].type;
+		has_mem |= type == O_SIB || type == O_IMM_ABSOLUTE;
+		has_imm |= type == O_IMM;
+	}
+	if (has_mem && has_imm)
+		return 0;
+
+	for (unsigned i = 0; i < sizeof fusible_mnemonics / sizeof *fusible_mnemonics; i++)
+		if (strcmp(instruction->mnemonic, fusible_mnemonics[i]) == 0)
+			return 1;
+	return 0;
+}
+
+void pad_branch(int len) {
+	elf_section_align(32);
+	uint64_t start = elf_section_offset();
+	if ((start >> 5) == ((start + len) >> 5))
+		return;
+
+	uint64_t padding = 32 - (start & 31);
+	write_nops(padding);
+	branch_padding += padding;
+}
+
+void flush_fusible(void) {
+	if (!has_fusible)
+		return;
+	write_encoded(&fusible);
+	has_fusible = 0;
+}
+
+void emit_instruction(struct instruction *instruction) {
+	struct encoded e = { 0 };
+	assemble_instruction(e.output, &e.len, instruction->mnemonic,
+						 instruction->prefixes, instruction->n_prefixes, instruction->operands,
+						 e.relocs, &e.n_relocs);
+
+	if (e.len <= 0) {
+		parse_send_error("no match for instruction");
+		ERROR("Couldn't encode instruction.");
+	}
+	e.terminator = is_terminator(instruction->mnemonic);
+
+	if (!align_branches) {
+		write_encoded(&e);
+	} else if (has_fusible && is_jcc(instruction->mnemonic)) {
+		pad_branch(fusible.len + e.len);
+		flush_fusible();
+		write_encoded(&e);
+	} else {
+		flush_fusible();
+		if (is_fusible(instruction)) {
+			fusible = e;
+			has_fusible = 1;
+		} else {
+			if (is_branch(instruction->mnemonic))
+				pad_branch(e.len);
+			write_encoded(&e);
+		}
+	}
+}
+
+// Instructions and labels go through the peephole optimizer before
+// reaching process_instruction and process_label if enabled.
+static int peephole = 0;
+
+// Use shorter equivalent encodings where possible, see narrow_instruction.
+static int optimize_size = 0;
+
+static int fold_functions = 0;
+static const char *symbol_ordering_file = NULL;
+static int function_sections = 0, data_sections = 0;
+static int keep_locals = 0;
+static int auto_size = 0;
+
+// Reads one symbol per line, ignoring empty lines and # comments as in lld.
+void order_functions(const char *path) {
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		ERROR("Could not open symbol ordering file %s", path);
+
+	size_t size = 0, cap = 0;
+	const char **names = NULL;
+
+	char line[1024];
+	while (fgets(line, sizeof line, fp)) {
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		char *name = strtok(line, " \t\r\n");
+		if (name)
+			ADD_ELEMENT(size, cap, names) = strdup(name);
+	}
+
+	fclose(fp);
+
+	elf_order_functions(names, size);
+	free(names);
+}
+
+void process_instruction(struct instruction *instruction) {
+	flip_order(instruction->operands);
+
+	if (optimize_size)
+		narrow_instruction(&instruction->mnemonic, instruction->operands);
+
+	for (int i = 0; i < 4; i++) {
+		struct operand *o = instruction->operands + i;
+		if (o->type == O_IMM || o->type == O_IMM_ABSOLUTE) {
+			resolve_expression_dot(&o->imm);
+		} else if (o->type == O_SIB) {
+			resolve_dot(&o->sib.str);
+			resolve_dot(&o->sib.sub);
+		}
+	}
+
+	emit_instruction(instruction);
+}
+
+void process_label(const char *name) {
+	flush_fusible();
+	elf_symbol_set_here(name, 0);
+}
+
 int main(int argc, char **argv) {
 	const char *input = NULL, *output = NULL;
-	if (argc != 3)
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-mbranches-within-32B-boundaries") == 0)
+			align_branches = 1;
+		else if (strcmp(argv[i], "--peephole") == 0)
+			peephole = 1;
+		else if (strcmp(argv[i], "-Os") == 0)
+			optimize_size = 1;
+		else if (strcmp(argv[i], "--icf") == 0)
+			fold_functions = 1;
+		else if (strcmp(argv[i], "-ffunction-sections") == 0)
+			function_sections = 1;
+		else if (strcmp(argv[i], "-fdata-sections") == 0)
+			data_sections = 1;
+		else if (strcmp(argv[i], "-L") == 0 || strcmp(argv[i], "--keep-locals") == 0)
+			keep_locals = 1;
+		else if (strcmp(argv[i], "--auto-size") == 0)
+			auto_size = 1;
+		else if (strcmp(argv[i], "--symbol-ordering-file") == 0 && i + 1 < argc)
+			symbol_ordering_file = argv[++i];
+		else if (argv[i][0] == '-')
+			ERROR("Unknown option %s", argv[i]);
+		else if (!input)
+			input = argv[i];
+		else if (!output)
+			output = argv[i];
+		else
+			ERROR("Invalid number of arguments");
+	}
+
+	if (!input || !output)
 		ERROR("Invalid number of arguments");
-	input = argv[1];
-	output = argv[2];
 
 	parse_init(input);
+	peephole_init(process_instruction, process_label);
 
 	elf_init();
 	for (;;) {
@@ -81,59 +363,92 @@ int main(int argc, char **argv) {
 		struct directive directive;
 		struct label label;
 		if (parse_label(&label)) {
-			elf_symbol_set_here(label.name, 0);
+			if (peephole)
+				peephole_label(label.name);
+			else
+				process_label(label.name);
 		} else if (parse_directive(&directive)) {
+			if (peephole)
+				peephole_flush();
+			flush_fusible();
 			switch (directive.type) {
 			case DIR_GLOBAL:
 				elf_symbol_set_global(directive.name);
 				break;
+			case DIR_TYPE:
+				elf_symbol_set_type(directive.symbol_type.name, directive.symbol_type.type);
+				break;
+			case DIR_SIZE:
+				resolve_expression_dot(&directive.symbol_size.size);
+				elf_symbol_set_size(directive.symbol_size.name, directive.symbol_size.size.str,
+									directive.symbol_size.size.sub, directive.symbol_size.size.value);
+				break;
+			case DIR_HIDDEN:
+				elf_symbol_set_visibility(directive.name, STV_HIDDEN);
+				break;
+			case DIR_PROTECTED:
+				elf_symbol_set_visibility(directive.name, STV_PROTECTED);
+				break;
+			case DIR_INTERNAL:
+				elf_symbol_set_visibility(directive.name, STV_INTERNAL);
+				break;
+			case DIR_FILE:
+				dwarf_file(directive.file.number, directive.file.dir, directive.file.name);
+				break;
+			case DIR_LOC:
+				dwarf_loc(&directive.loc);
+				break;
+			case DIR_CFI:
+				dwarf_cfi(&directive.cfi);
+				break;
+			case DIR_ADDRSIG:
+				elf_symbol_set_address_significant(directive.name);
+				break;
+			case DIR_COMM:
+				elf_symbol_set_common(directive.common.name, directive.common.size,
+									  directive.common.alignment);
+				break;
+			case DIR_LCOMM:
+				elf_symbol_set_local_common(directive.common.name, directive.common.size,
+											directive.common.alignment);
+				break;
 			case DIR_STRING:
 				write_escaped_string(directive.name);
 				// TODO: Escape characters
 				break;
 			case DIR_SECTION:
-				elf_set_section(directive.name);
+				elf_set_section(directive.section.name);
+				if (directive.section.flags || directive.section.type || directive.section.entsize)
+					elf_section_set_attributes(directive.section.flags, directive.section.type,
+											   directive.section.entsize);
 				break;
 			case DIR_ZERO:
-				assert(directive.immediate.str == NULL);
 				elf_write_zero(directive.immediate.value);
 				break;
 			case DIR_QUAD:
-				if (directive.immediate.str)
-					elf_symbol_relocate_here(directive.immediate.str, 0, R_X86_64_64);
-				elf_write((uint8_t *)&directive.immediate.value, 8);
+				write_expression(&directive.immediate, 8);
+				break;
+			case DIR_LONG:
+				write_expression(&directive.immediate, 4);
+				break;
+			case DIR_WORD:
+				write_expression(&directive.immediate, 2);
 				break;
 			case DIR_BYTE:
-				if (directive.immediate.str)
-					NOTIMP();
-				elf_write((uint8_t *)&directive.immediate.value, 1);
+				write_expression(&directive.immediate, 1);
+				break;
+			case DIR_ALIGN:
+				align(directive.align.alignment, directive.align.has_fill,
+					  directive.align.fill, directive.align.max);
 				break;
 			default:
 				NOTIMP();
 			}
 		} else if (parse_instruction(&instruction)) {
-			flip_order(instruction.operands);
-
-			uint8_t output[15] = { 0 };
-			int len;
-			char *reloc_name = NULL;
-			int reloc_offset = 0;
-			int reloc_relative = 0;
-			assemble_instruction(output, &len, instruction.mnemonic,
-								 instruction.operands,
-								 &reloc_name, &reloc_offset, &reloc_relative);
-
-			if (len <= 0) {
-				parse_send_error("no match for instruction");
-				ERROR("Couldn't encode instruction.");
-			}
-
-			if (reloc_name) {
-				int type = reloc_relative ? R_X86_64_PC32 : R_X86_64_32S;
-				elf_symbol_relocate_here(reloc_name, reloc_offset, type);
-			}
-
-			elf_write(output, len);
+			if (peephole)
+				peephole_instruction(&instruction);
+			else
+				process_instruction(&instruction);
 		} else if (parse_is_eof()) {
 			break;
 		} else {
@@ -141,7 +456,30 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (peephole)
+		peephole_flush();
+	flush_fusible();
 	parse_close();
 
+	if (peephole)
+		peephole_print_statistics();
+	if (align_branches)
+		fprintf(stderr, "Branch alignment: %lu bytes of padding\n", branch_padding);
+
+	if (fold_functions)
+		elf_fold_identical_functions();
+	if (symbol_ordering_file)
+		order_functions(symbol_ordering_file);
+	if (align_branches)
+		elf_keep_branch_alignment();
+	if (function_sections || data_sections)
+		elf_split_sections(function_sections, data_sections);
+	dwarf_finish();
+
+	if (keep_locals)
+		elf_keep_local_labels();
+	if (auto_size)
+		elf_auto_size_symbols();
+
 	elf_finish(output);
 }
@@ -1,10 +1,12 @@
 #include "parser.h"
+#include "darray.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #define ERROR(STR, ...) do { printf("Error on line %d file %s: \"" STR "\"\n", __LINE__, __FILE__, ##__VA_ARGS__); exit(1); } while(0)
 #define NOTIMP() ERROR("Not implemented");
@@ -53,21 +55,25 @@ int is_digit(char c) {
 	return (c >= '0' && c <= '9');
 }
 
-int is_start_of_number(char c) {
-	return is_digit(c) || c == '+' || c == '-';
+int is_operator(char c) {
+	return c == '+' || c == '-' || c == '*' || c == '/' || c == '%' ||
+		c == '|' || c == '&' || c == '^' || c == '~';
 }
 
-// Todo: make this crash when exceeding buffer size.
-int input_get_identifier(char *buffer) {
+// Identifiers and strings are returned in a new buffer of any length.
+int input_get_identifier(char **str) {
 	if (!is_identifier(input[0]))
 		return 0;
 
+	size_t size = 0, cap = 0;
+	char *buffer = NULL;
 	while (is_identifier(input[0]) || is_digit(input[0])) {
-		*(buffer++) = input[0];
+		ADD_ELEMENT(size, cap, buffer) = input[0];
 		input_next();
 	}
 
-	*buffer = '\0';
+	ADD_ELEMENT(size, cap, buffer) = '\0';
+	*str = buffer;
 
 	return 1;
 }
@@ -164,6 +170,12 @@ int input_get_register_trie(enum reg *reg, int *size, int *rex) {
 			}
 		default: return 0;
 		}
+	case 'f': input_next();
+		input_expect('s');
+		*reg = REG_FS; *size = 0; *rex = 0; return 1;
+	case 'g': input_next();
+		input_expect('s');
+		*reg = REG_GS; *size = 0; *rex = 0; return 1;
 	case 'r': input_next();
 		switch(input[0]) {
 		case '1': input_next();
@@ -261,6 +273,9 @@ int input_get_register_trie(enum reg *reg, int *size, int *rex) {
 		case 'a': input_next();
 			input_expect('x');
 			*reg = REG_RAX; *size = 8; *rex = 0; return 1;
+		case 'i': input_next();
+			input_expect('p');
+			*reg = REG_RIP; *size = 8; *rex = 0; return 1;
 		case 'b': input_next();
 			switch(input[0]) {
 			case 'p': input_next();
@@ -326,65 +341,69 @@ int input_get_register(enum reg *reg, int *size, int *rex) {
 }
 
 int input_get_number(uint64_t *immediate) {
-	if (!is_start_of_number(input[0]))
+	if (!is_digit(input[0]))
 		return 0;
 
 	char buffer[256];
 	int idx = 0;
-	while (is_digit(input[0]) || input[0] == '-') {
+	int base = 10;
+	if (input[0] == '0' && (input[1] == 'x' || input[1] == 'X')) {
+		base = 16;
+		input_next();
+		input_next();
+	}
+
+	while (base == 16 ? isxdigit(input[0]) : is_digit(input[0])) {
 		buffer[idx++] = input[0];
 		input_next();
 	}
 	buffer[idx] = '\0';
 
-	if (input[0] == '-')
-		*immediate = strtol(buffer, NULL, 10);
-	else
-		*immediate = strtoul(buffer, NULL, 10);
+	*immediate = strtoull(buffer, NULL, base);
 
 	return 1;
 }
 
-int input_get_immediate(uint64_t *immediate) {
-	if (input[0] != '$' || !is_start_of_number(input[1]))
-		return 0;
-
-	input_next();
-
-	if (!input_get_number(immediate))
-		ERROR("Expected number after $ on line %d, got char %c", line, input[0]);
-
-	return 1;
-}
+// Reads an operator into a single character. << and >> become < and >.
+int input_get_operator(char *op) {
+	if ((input[0] == '<' && input[1] == '<') ||
+		(input[0] == '>' && input[1] == '>')) {
+		*op = input[0];
+		input_next();
+		input_next();
+		return 1;
+	}
 
-int input_get_immediate_identifier(char *buffer) {
-	if (input[0] != '$')
+	// *%reg and %reg are registers, not multiplication and modulo.
+	if (!is_operator(input[0]) ||
+		(input[0] == '*' && input[1] == '%') ||
+		(input[0] == '%' && is_alpha(input[1])))
 		return 0;
 
+	*op = input[0];
 	input_next();
-
-	if (!input_get_identifier(buffer))
-		ERROR("Expected number after $ on line %d, got char %c", line, input[0]);
-
 	return 1;
 }
 
-int input_get_string(char *buffer) {
+int input_get_string(char **str) {
 	if (input[0] != '"')
 		return 0;
 
+	size_t size = 0, cap = 0;
+	char *buffer = NULL;
 	input_next();
 	while (input[0] != '"') {
 		if (input[0] == '\\' && input[1] == '"') {
-			*(buffer++) = input[0];
+			ADD_ELEMENT(size, cap, buffer) = input[0];
 			input_next();
 		}
 
-		*(buffer++) = input[0];
+		ADD_ELEMENT(size, cap, buffer) = input[0];
 		input_next();
 	}
 
-	*buffer = '\0';
+	ADD_ELEMENT(size, cap, buffer) = '\0';
+	*str = buffer;
 	input_next();
 
 	return 1;
@@ -399,13 +418,14 @@ struct token {
 		T_REGISTER,
 		T_STAR_REGISTER,
 		T_NUMBER,
-		T_IMMEDIATE,
-		T_IMMEDIATE_IDENTIFIER,
+		T_DOLLAR,
+		T_OPERATOR,
 		T_COMMA,
 		T_COLON,
 		T_LEFT_PARENTHESIS,
 		T_RIGHT_PARENTHESIS,
-		T_STRING
+		T_STRING,
+		T_AT
 	} type;
 
 	union {
@@ -415,6 +435,7 @@ struct token {
 			int size, rex;
 		} register_;
 		uint64_t immediate;
+		char op;
 	};
 
 	int line;
@@ -451,7 +472,6 @@ void token_next(void) {
 		   token_flush_comment());
 
 	int token_start_line = line;
-	static char tok_buffer[256] = { 0 };
 
 	if (input[0] == '\0') {
 		tokens[1].type = T_EOF;
@@ -467,19 +487,21 @@ void token_next(void) {
 	} else if (input[0] == ':') {
 		tokens[1].type = T_COLON;
 		input_next();
-	} else if (input[0] == '\n') {
+	} else if (input[0] == '@') {
+		tokens[1].type = T_AT;
+		input_next();
+	} else if (input[0] == '$') {
+		tokens[1].type = T_DOLLAR;
+		input_next();
+	} else if (input_get_operator(&tokens[1].op)) {
+		tokens[1].type = T_OPERATOR;
+	} else if (input[0] == '\n' || input[0] == ';') {
 		tokens[1].type = T_NEWLINE;
 		input_next();
-	} else if (input_get_identifier(tok_buffer)) {
-		tokens[1] = (struct token) {
-			.type = T_IDENTIFIER,
-			.identifier = strdup(tok_buffer)
-		};
-	} else if (input_get_string(tok_buffer)) {
-		tokens[1] = (struct token) {
-			.type = T_STRING,
-			.identifier = strdup(tok_buffer)
-		};
+	} else if (input_get_identifier(&tokens[1].identifier)) {
+		tokens[1].type = T_IDENTIFIER;
+	} else if (input_get_string(&tokens[1].identifier)) {
+		tokens[1].type = T_STRING;
 	} else if (input_get_register(&tokens[1].register_.reg,
 								  &tokens[1].register_.size,
 								  &tokens[1].register_.rex)) {
@@ -491,13 +513,6 @@ void token_next(void) {
 								&tokens[1].register_.rex))
 			ERROR("Expected register after *");
 		tokens[1].type = T_STAR_REGISTER;
-	} else if (input_get_immediate(&tokens[1].immediate)) {
-		tokens[1].type = T_IMMEDIATE;
-	} else if (input_get_immediate_identifier(tok_buffer)) {
-		tokens[1] = (struct token) {
-			.type = T_IMMEDIATE_IDENTIFIER,
-			.identifier = strdup(tok_buffer)
-		};
 	} else if (input_get_number(&tokens[1].immediate)) {
 		tokens[1].type = T_NUMBER;
 	} else {
@@ -540,29 +555,227 @@ void parse_close(void) {
 }
 
 // Parse functions.
-static int parse_sib(struct operand *operand) {
-	if (tokens[0].type == T_NUMBER && tokens[1].type == T_LEFT_PARENTHESIS) {
-		operand->sib.offset = tokens[0].immediate;
+static enum modifier parse_modifier(void) {
+	static const struct {
+		const char *name;
+		enum modifier modifier;
+	} modifiers[] = {
+		{ "PLT", MOD_PLT },
+		{ "GOTPCREL", MOD_GOTPCREL },
+		{ "TPOFF", MOD_TPOFF },
+		{ "GOTTPOFF", MOD_GOTTPOFF },
+		{ "TLSGD", MOD_TLSGD },
+		{ "TLSLD", MOD_TLSLD },
+		{ "DTPOFF", MOD_DTPOFF },
+	};
+
+	if (!token_accept(T_AT))
+		return MOD_NONE;
+
+	if (tokens[0].type != T_IDENTIFIER)
+		ERROR("Expected relocation modifier after @ on line %d", tokens[0].line);
+
+	for (unsigned i = 0; i < sizeof modifiers / sizeof *modifiers; i++) {
+		if (strcasecmp(modifiers[i].name, tokens[0].identifier) == 0) {
+			token_next();
+			return modifiers[i].modifier;
+		}
+	}
+
+	ERROR("Unknown relocation modifier @%s on line %d", tokens[0].identifier, tokens[0].line);
+}
+
+static int is_expression_start(void) {
+	switch (tokens[0].type) {
+	case T_NUMBER:
+	case T_IDENTIFIER:
+	case T_LEFT_PARENTHESIS:
+		return 1;
+	case T_OPERATOR:
+		return tokens[0].op == '-' || tokens[0].op == '+' || tokens[0].op == '~';
+	default:
+		return 0;
+	}
+}
+
+// Computes a = a + b, or a = a - b if negate is set.
+static void expression_add(struct expression *a, struct expression *b, int negate) {
+	char *add = negate ? b->sub : b->str;
+	char *sub = negate ? b->str : b->sub;
+
+	a->value += negate ? -b->value : b->value;
+
+	if (add) {
+		if (a->sub && strcmp(a->sub, add) == 0)
+			a->sub = NULL;
+		else if (a->str)
+			ERROR("Can not add two symbols on line %d", tokens[0].line);
+		else
+			a->str = add;
+	}
+
+	if (sub) {
+		if (a->str && strcmp(a->str, sub) == 0)
+			a->str = NULL;
+		else if (a->sub)
+			ERROR("Can not subtract two symbols on line %d", tokens[0].line);
+		else
+			a->sub = sub;
+	}
+
+	if (b->modifier) {
+		if (a->modifier)
+			ERROR("Multiple relocation modifiers on line %d", tokens[0].line);
+		a->modifier = b->modifier;
+	}
+}
+
+static void parse_expression(struct expression *expr);
+
+static void parse_term(struct expression *expr) {
+	*expr = (struct expression) { 0 };
+
+	if (tokens[0].type == T_NUMBER) {
+		expr->value = tokens[0].immediate;
+		token_next();
+	} else if (tokens[0].type == T_IDENTIFIER) {
+		expr->str = tokens[0].identifier;
+		token_next();
+		expr->modifier = parse_modifier();
+	} else if (token_accept(T_LEFT_PARENTHESIS)) {
+		parse_expression(expr);
+		token_expect(T_RIGHT_PARENTHESIS);
+	} else if (tokens[0].type == T_OPERATOR && tokens[0].op == '+') {
 		token_next();
-	} else if (tokens[0].type == T_LEFT_PARENTHESIS) {
-		operand->sib.offset = 0;
+		parse_term(expr);
+	} else if (tokens[0].type == T_OPERATOR && tokens[0].op == '-') {
+		token_next();
+		struct expression rhs;
+		parse_term(&rhs);
+		expression_add(expr, &rhs, 1);
+	} else if (tokens[0].type == T_OPERATOR && tokens[0].op == '~') {
+		token_next();
+		parse_term(expr);
+		if (expr->str || expr->sub)
+			ERROR("Can not apply ~ to symbol on line %d", tokens[0].line);
+		expr->value = ~expr->value;
 	} else {
+		ERROR("Expected expression on line %d", tokens[0].line);
+	}
+}
+
+// Same precedence levels as GNU as, which differ from C.
+static int get_precedence(char op) {
+	switch (op) {
+	case '*': case '/': case '%': case '<': case '>':
+		return 3;
+	case '|': case '&': case '^':
+		return 2;
+	case '+': case '-':
+		return 1;
+	default:
 		return 0;
 	}
+}
 
-	token_expect(T_LEFT_PARENTHESIS);
+static void parse_binary(struct expression *lhs, int min_precedence) {
+	parse_term(lhs);
 
-	if (tokens[0].type != T_REGISTER)
-		ERROR("Expected register as first argument of SIB");
+	while (tokens[0].type == T_OPERATOR &&
+		   get_precedence(tokens[0].op) >= min_precedence) {
+		char op = tokens[0].op;
+		token_next();
+
+		struct expression rhs;
+		parse_binary(&rhs, get_precedence(op) + 1);
+
+		if (op == '+' || op == '-') {
+			expression_add(lhs, &rhs, op == '-');
+			continue;
+		}
+
+		if (lhs->str || lhs->sub || rhs.str || rhs.sub)
+			ERROR("Can not apply operator %c to symbol on line %d", op, tokens[0].line);
+
+		int64_t a = lhs->value, b = rhs.value;
+		if ((op == '/' || op == '%') && b == 0)
+			ERROR("Division by zero on line %d", tokens[0].line);
+
+		switch (op) {
+		case '*': lhs->value = a * b; break;
+		case '/': lhs->value = a / b; break;
+		case '%': lhs->value = a % b; break;
+		case '<': lhs->value = lhs->value << b; break;
+		case '>': lhs->value = lhs->value >> b; break;
+		case '|': lhs->value = a | b; break;
+		case '&': lhs->value = a & b; break;
+		case '^': lhs->value = a ^ b; break;
+		}
+	}
+}
+
+static void parse_expression(struct expression *expr) {
+	parse_binary(expr, 1);
+}
+
+static uint64_t parse_constant(void) {
+	struct expression expr;
+	parse_expression(&expr);
+	if (expr.str || expr.sub)
+		ERROR("Expected constant on line %d", tokens[0].line);
+	return expr.value;
+}
+
+// Parses [%seg:]disp[(base[, index[, scale]])].
+// A symbol with no segment or parentheses is a branch target.
+static int parse_sib(struct operand *operand) {
+	enum reg segment = REG_NONE;
+	if (tokens[0].type == T_REGISTER && tokens[1].type == T_COLON) {
+		segment = tokens[0].register_.reg;
+		if (segment != REG_FS && segment != REG_GS)
+			ERROR("Expected segment register on line %d", tokens[0].line);
+		token_next();
+		token_next();
+	}
+
+	struct expression disp = { 0 };
+	int has_disp = !(tokens[0].type == T_LEFT_PARENTHESIS &&
+					 (tokens[1].type == T_REGISTER || tokens[1].type == T_COMMA));
+	if (has_disp) {
+		if (!is_expression_start())
+			return 0;
+		parse_expression(&disp);
+	}
+
+	if (tokens[0].type != T_LEFT_PARENTHESIS && segment == REG_NONE) {
+		if (!disp.str)
+			ERROR("Expected ( after displacement on line %d", tokens[0].line);
+
+		operand->type = O_IMM_ABSOLUTE;
+		operand->imm = disp;
+		return 1;
+	}
 
 	operand->type = O_SIB;
 
+	operand->sib.offset = disp.value;
+	operand->sib.str = disp.str;
+	operand->sib.sub = disp.sub;
+	operand->sib.modifier = disp.modifier;
 	operand->sib.base = REG_NONE;
 	operand->sib.scale = 1;
 	operand->sib.index = REG_NONE;
+	operand->sib.segment = segment;
 
-	operand->sib.base = tokens[0].register_.reg;
-	token_next();
+	if (!token_accept(T_LEFT_PARENTHESIS))
+		return 1;
+
+	if (tokens[0].type == T_REGISTER) {
+		operand->sib.base = tokens[0].register_.reg;
+		token_next();
+	} else if (tokens[0].type != T_COMMA) {
+		ERROR("Expected register as first argument of SIB");
+	}
 
 	if (token_accept(T_COMMA)) {
 		if (tokens[0].type != T_REGISTER)
@@ -571,13 +784,8 @@ static int parse_sib(struct operand *operand) {
 		operand->sib.index = tokens[0].register_.reg;
 		token_next();
 
-		if (token_accept(T_COMMA)) {
-			if (tokens[0].type != T_NUMBER)
-				ERROR("Expected number as third argument of SIB");
-
-			operand->sib.scale = tokens[0].immediate;
-			token_next();
-		}
+		if (token_accept(T_COMMA))
+			operand->sib.scale = parse_constant();
 	}
 
 	token_expect(T_RIGHT_PARENTHESIS);
@@ -588,6 +796,9 @@ static int parse_sib(struct operand *operand) {
 static int parse_operand(struct operand *operand) {
 	switch (tokens[0].type) {
 	case T_REGISTER:
+		if (tokens[1].type == T_COLON)
+			return parse_sib(operand);
+
 		operand->type = O_REG;
 		operand->reg.reg = tokens[0].register_.reg;
 		operand->reg.size = tokens[0].register_.size;
@@ -603,25 +814,10 @@ static int parse_operand(struct operand *operand) {
 		token_next();
 		return 1;
 
-	case T_IMMEDIATE:
-		operand->type = O_IMM;
-		operand->imm.value = tokens[0].immediate;
-		operand->imm.str = NULL;
+	case T_DOLLAR:
 		token_next();
-		return 1;
-
-	case T_IMMEDIATE_IDENTIFIER:
 		operand->type = O_IMM;
-		operand->imm.value = 0;
-		operand->imm.str = tokens[0].identifier;
-		token_next();
-		return 1;
-
-	case T_IDENTIFIER:
-		operand->type = O_IMM_ABSOLUTE;
-		operand->imm.value = 0;
-		operand->imm.str = tokens[0].identifier;
-		token_next();
+		parse_expression(&operand->imm);
 		return 1;
 
 	default:
@@ -629,10 +825,62 @@ static int parse_operand(struct operand *operand) {
 	}
 }
 
+// An instruction takes at most one prefix of each group, lock and the
+// repeat prefixes exclude each other.
+enum {
+	PREFIX_LOCK_REP = 1,
+	PREFIX_OPERAND_SIZE = 2,
+	PREFIX_REX = 4,
+};
+
+static uint8_t get_prefix(const char *name, int *group) {
+	static const struct {
+		const char *name;
+		uint8_t byte;
+		int group;
+	} prefixes[] = {
+		{ "lock", 0xf0, PREFIX_LOCK_REP },
+		{ "rep", 0xf3, PREFIX_LOCK_REP },
+		{ "repe", 0xf3, PREFIX_LOCK_REP },
+		{ "repz", 0xf3, PREFIX_LOCK_REP },
+		{ "repne", 0xf2, PREFIX_LOCK_REP },
+		{ "repnz", 0xf2, PREFIX_LOCK_REP },
+		// Used for padding in the TLS general dynamic sequence.
+		{ "data16", 0x66, PREFIX_OPERAND_SIZE },
+		{ "rex64", 0x48, PREFIX_REX },
+	};
+
+	for (unsigned i = 0; i < sizeof prefixes / sizeof *prefixes; i++) {
+		if (strcmp(prefixes[i].name, name) == 0) {
+			*group = prefixes[i].group;
+			return prefixes[i].byte;
+		}
+	}
+	return 0;
+}
+
 int parse_instruction(struct instruction *instruction) {
 	if (tokens[0].type != T_IDENTIFIER)
 		return 0;
 
+	// Prefixes are written either before the instruction on the
+	// same line, or as a statement of their own (e.g. "rep; movsb").
+	instruction->n_prefixes = 0;
+	uint8_t prefix;
+	int group, groups = 0;
+	while (tokens[0].type == T_IDENTIFIER &&
+		   (prefix = get_prefix(tokens[0].identifier, &group))) {
+		if (groups & group)
+			ERROR("Conflicting prefix %s on line %d", tokens[0].identifier, tokens[0].line);
+		groups |= group;
+		instruction->prefixes[instruction->n_prefixes++] = prefix;
+		token_next();
+		while (token_accept(T_NEWLINE));
+	}
+
+	if (tokens[0].type != T_IDENTIFIER)
+		ERROR("Expected instruction after prefix on line %d", tokens[0].line);
+
 	instruction->mnemonic = tokens[0].identifier;
 	token_next();
 
@@ -661,29 +909,298 @@ int parse_label(struct label *label) {
 	return 1;
 }
 
+// Section names may contain dashes, as in .note.GNU-stack, which
+// are lexed as operators between identifiers.
+static char *parse_section_name(void) {
+	if (tokens[0].type == T_STRING) {
+		char *name = tokens[0].identifier;
+		token_next();
+		return name;
+	}
+
+	if (tokens[0].type != T_IDENTIFIER)
+		ERROR("Expected section name on line %d", tokens[0].line);
+
+	char *name = tokens[0].identifier;
+	token_next();
+	while (tokens[0].type == T_OPERATOR && tokens[0].op == '-' &&
+		   tokens[1].type == T_IDENTIFIER) {
+		char *joined = malloc(strlen(name) + strlen(tokens[1].identifier) + 2);
+		sprintf(joined, "%s-%s", name, tokens[1].identifier);
+		name = joined;
+		token_next();
+		token_next();
+	}
+	return name;
+}
+
+// Registers as numbered by DWARF on x86-64, or given as a number.
+static int parse_cfi_register(void) {
+	static const int numbers[] = {
+		[REG_RAX] = 0, [REG_RDX] = 1, [REG_RCX] = 2, [REG_RBX] = 3,
+		[REG_RSI] = 4, [REG_RDI] = 5, [REG_RBP] = 6, [REG_RSP] = 7,
+		[REG_R8] = 8, [REG_R9] = 9, [REG_R10] = 10, [REG_R11] = 11,
+		[REG_R12] = 12, [REG_R13] = 13, [REG_R14] = 14, [REG_R15] = 15,
+		[REG_RIP] = 16,
+	};
+
+	if (tokens[0].type == T_REGISTER) {
+		enum reg reg = tokens[0].register_.reg;
+		if (tokens[0].register_.size != 8 || reg == REG_NONE || reg > REG_RIP)
+			ERROR("Expected 64-bit register on line %d", tokens[0].line);
+		token_next();
+		return numbers[reg];
+	}
+
+	return parse_constant();
+}
+
+static int parse_cfi(const char *name, struct cfi *cfi) {
+	enum {
+		OPS_NONE,
+		OPS_REG,
+		OPS_OFFSET,
+		OPS_REG_OFFSET,
+		OPS_REG_REG,
+		OPS_POINTER,
+		OPS_BYTES,
+		OPS_NAMES,
+	};
+
+	static const struct {
+		const char *name;
+		int type, operands;
+	} cfi_directives[] = {
+		{ ".cfi_startproc", CFI_STARTPROC, OPS_NONE },
+		{ ".cfi_endproc", CFI_ENDPROC, OPS_NONE },
+		{ ".cfi_def_cfa", CFI_DEF_CFA, OPS_REG_OFFSET },
+		{ ".cfi_def_cfa_register", CFI_DEF_CFA_REGISTER, OPS_REG },
+		{ ".cfi_def_cfa_offset", CFI_DEF_CFA_OFFSET, OPS_OFFSET },
+		{ ".cfi_adjust_cfa_offset", CFI_ADJUST_CFA_OFFSET, OPS_OFFSET },
+		{ ".cfi_offset", CFI_OFFSET, OPS_REG_OFFSET },
+		{ ".cfi_rel_offset", CFI_REL_OFFSET, OPS_REG_OFFSET },
+		{ ".cfi_register", CFI_REGISTER, OPS_REG_REG },
+		{ ".cfi_restore", CFI_RESTORE, OPS_REG },
+		{ ".cfi_undefined", CFI_UNDEFINED, OPS_REG },
+		{ ".cfi_same_value", CFI_SAME_VALUE, OPS_REG },
+		{ ".cfi_remember_state", CFI_REMEMBER_STATE, OPS_NONE },
+		{ ".cfi_restore_state", CFI_RESTORE_STATE, OPS_NONE },
+		{ ".cfi_escape", CFI_ESCAPE, OPS_BYTES },
+		{ ".cfi_personality", CFI_PERSONALITY, OPS_POINTER },
+		{ ".cfi_lsda", CFI_LSDA, OPS_POINTER },
+		{ ".cfi_signal_frame", CFI_SIGNAL_FRAME, OPS_NONE },
+		{ ".cfi_sections", CFI_SECTIONS, OPS_NAMES },
+	};
+
+	unsigned i = 0;
+	while (i < sizeof cfi_directives / sizeof *cfi_directives && strcmp(cfi_directives[i].name, name) != 0)
+		i++;
+	if (i == sizeof cfi_directives / sizeof *cfi_directives)
+		return 0;
+
+	token_next();
+	memset(cfi, 0, sizeof *cfi);
+	cfi->type = cfi_directives[i].type;
+
+	switch (cfi_directives[i].operands) {
+	case OPS_NONE:
+		if (cfi->type == CFI_STARTPROC && tokens[0].type == T_IDENTIFIER &&
+			strcmp(tokens[0].identifier, "simple") == 0) {
+			cfi->simple = 1;
+			token_next();
+		}
+		break;
+	case OPS_REG:
+		cfi->regs[0] = parse_cfi_register();
+		break;
+	case OPS_OFFSET:
+		cfi->offset = parse_constant();
+		break;
+	case OPS_REG_OFFSET:
+		cfi->regs[0] = parse_cfi_register();
+		token_expect(T_COMMA);
+		cfi->offset = parse_constant();
+		break;
+	case OPS_REG_REG:
+		cfi->regs[0] = parse_cfi_register();
+		token_expect(T_COMMA);
+		cfi->regs[1] = parse_cfi_register();
+		break;
+	case OPS_POINTER:
+		cfi->encoding = parse_constant();
+		if (cfi->encoding != 0xff) {
+			token_expect(T_COMMA);
+			if (tokens[0].type != T_IDENTIFIER)
+				ERROR("Expected symbol on line %d", tokens[0].line);
+			cfi->symbol = tokens[0].identifier;
+			token_next();
+		}
+		break;
+	case OPS_BYTES: {
+		size_t cap = 0, size = 0;
+		do
+			ADD_ELEMENT(size, cap, cfi->bytes) = parse_constant();
+		while (token_accept(T_COMMA));
+		cfi->n_bytes = size;
+		break;
+	}
+	case OPS_NAMES:
+		// Only .eh_frame is generated.
+		do {
+			if (tokens[0].type != T_IDENTIFIER)
+				ERROR("Expected section name on line %d", tokens[0].line);
+			token_next();
+		} while (token_accept(T_COMMA));
+		break;
+	}
+
+	token_expect(T_NEWLINE);
+	return 1;
+}
+
 int parse_directive(struct directive *directive) {
 	if (tokens[0].type != T_IDENTIFIER)
 		return 0;
 
 	char *name = tokens[0].identifier;
-	if (strcmp(name, ".section") == 0) {
+	if (parse_cfi(name, &directive->cfi)) {
+		directive->type = DIR_CFI;
+		return 1;
+	} else if (strcmp(name, ".section") == 0) {
+		// .section name[, "flags"[, @type[, entsize]]]
+		token_next();
+		directive->type = DIR_SECTION;
+		directive->section.name = parse_section_name();
+		directive->section.flags = NULL;
+		directive->section.type = NULL;
+		directive->section.entsize = 0;
+		if (token_accept(T_COMMA)) {
+			if (tokens[0].type != T_STRING)
+				ERROR("Expected section flags on line %d", tokens[0].line);
+			directive->section.flags = tokens[0].identifier;
+			token_next();
+		}
+		if (token_accept(T_COMMA)) {
+			token_expect(T_AT);
+			if (tokens[0].type != T_IDENTIFIER)
+				ERROR("Expected section type on line %d", tokens[0].line);
+			directive->section.type = tokens[0].identifier;
+			token_next();
+		}
+		if (token_accept(T_COMMA))
+			directive->section.entsize = parse_constant();
+		token_expect(T_NEWLINE);
+		return 1;
+	} else if (strcmp(name, ".text") == 0 || strcmp(name, ".data") == 0 ||
+			   strcmp(name, ".bss") == 0) {
+		token_next();
+		directive->type = DIR_SECTION;
+		directive->section.name = name;
+		directive->section.flags = NULL;
+		directive->section.type = NULL;
+		directive->section.entsize = 0;
+		token_expect(T_NEWLINE);
+		return 1;
+	} else if (strcmp(name, ".comm") == 0 || strcmp(name, ".lcomm") == 0) {
 		token_next();
 		if (tokens[0].type != T_IDENTIFIER)
 			ERROR("Expected identifer on line %d", tokens[0].line);
-		directive->type = DIR_SECTION;
-		directive->name = tokens[0].identifier;
+		directive->type = strcmp(name, ".comm") == 0 ? DIR_COMM : DIR_LCOMM;
+		directive->common.name = tokens[0].identifier;
 		token_next();
+		token_expect(T_COMMA);
+		directive->common.size = parse_constant();
+		directive->common.alignment = 0;
+		if (token_accept(T_COMMA))
+			directive->common.alignment = parse_constant();
 		token_expect(T_NEWLINE);
 		return 1;
-	} else if (strcmp(name, ".global") == 0) {
+	} else if (strcmp(name, ".type") == 0) {
+		// .type name, @function, also written as "function" or STT_FUNC.
 		token_next();
 		if (tokens[0].type != T_IDENTIFIER)
 			ERROR("Expected identifer on line %d", tokens[0].line);
-		directive->type = DIR_GLOBAL;
-		directive->name = tokens[0].identifier;
+		directive->type = DIR_TYPE;
+		directive->symbol_type.name = tokens[0].identifier;
+		token_next();
+		token_expect(T_COMMA);
+		token_accept(T_AT);
+		if (tokens[0].type != T_IDENTIFIER && tokens[0].type != T_STRING)
+			ERROR("Expected symbol type on line %d", tokens[0].line);
+		directive->symbol_type.type = tokens[0].identifier;
 		token_next();
 		token_expect(T_NEWLINE);
 		return 1;
+	} else if (strcmp(name, ".size") == 0) {
+		token_next();
+		if (tokens[0].type != T_IDENTIFIER)
+			ERROR("Expected identifer on line %d", tokens[0].line);
+		directive->type = DIR_SIZE;
+		directive->symbol_size.name = tokens[0].identifier;
+		token_next();
+		token_expect(T_COMMA);
+		parse_expression(&directive->symbol_size.size);
+		token_expect(T_NEWLINE);
+		return 1;
+	} else if (strcmp(name, ".file") == 0) {
+		// .file "name", .file N "name" or .file N "dir" "name" [md5 value]
+		token_next();
+		directive->type = DIR_FILE;
+		directive->file.number = -1;
+		directive->file.dir = NULL;
+		if (tokens[0].type == T_NUMBER) {
+			directive->file.number = tokens[0].immediate;
+			token_next();
+		}
+		if (tokens[0].type != T_STRING)
+			ERROR("Expected file name on line %d", tokens[0].line);
+		directive->file.name = tokens[0].identifier;
+		token_next();
+		if (tokens[0].type == T_STRING) {
+			directive->file.dir = directive->file.name;
+			directive->file.name = tokens[0].identifier;
+			token_next();
+		}
+		if (tokens[0].type == T_IDENTIFIER && strcmp(tokens[0].identifier, "md5") == 0) {
+			token_next();
+			token_expect(T_NUMBER);
+		}
+		token_expect(T_NEWLINE);
+		return 1;
+	} else if (strcmp(name, ".loc") == 0) {
+		// .loc file line [column] [options]
+		token_next();
+		directive->type = DIR_LOC;
+		memset(&directive->loc, 0, sizeof directive->loc);
+		directive->loc.is_stmt = -1;
+		directive->loc.file = parse_constant();
+		directive->loc.line = parse_constant();
+		if (tokens[0].type == T_NUMBER)
+			directive->loc.column = parse_constant();
+
+		while (tokens[0].type == T_IDENTIFIER) {
+			char *option = tokens[0].identifier;
+			token_next();
+			if (strcmp(option, "basic_block") == 0) {
+				directive->loc.basic_block = 1;
+			} else if (strcmp(option, "prologue_end") == 0) {
+				directive->loc.prologue_end = 1;
+			} else if (strcmp(option, "epilogue_begin") == 0) {
+				directive->loc.epilogue_begin = 1;
+			} else if (strcmp(option, "is_stmt") == 0) {
+				directive->loc.is_stmt = parse_constant() != 0;
+			} else if (strcmp(option, "discriminator") == 0) {
+				directive->loc.discriminator = parse_constant();
+			} else if (strcmp(option, "isa") == 0 || strcmp(option, "view") == 0) {
+				// Views are only used by location lists, which are not supported.
+				struct expression ignored;
+				parse_expression(&ignored);
+			} else {
+				ERROR("Unknown .loc option %s on line %d", option, tokens[0].line);
+			}
+		}
+		token_expect(T_NEWLINE);
+		return 1;
 	} else if (strcmp(name, ".string") == 0) {
 		token_next();
 		if (tokens[0].type != T_STRING)
@@ -695,47 +1212,86 @@ int parse_directive(struct directive *directive) {
 		return 1;
 	} else if (strcmp(name, ".zero") == 0) {
 		token_next();
-		directive->immediate.value = 0;
-		directive->immediate.str = 0;
-		if (tokens[0].type == T_NUMBER) {
-			directive->immediate.value = tokens[0].immediate;
-		} else if (tokens[0].type == T_IDENTIFIER) {
-			directive->immediate.str = tokens[0].identifier;
-		} else {
-			ERROR("Expected number on line %d", tokens[0].line);
-		}
 		directive->type = DIR_ZERO;
-		token_next();
+		directive->immediate = (struct expression) { .value = parse_constant() };
 		token_expect(T_NEWLINE);
 		return 1;
-	} else if (strcmp(name, ".quad") == 0) {
+	} else if (strcmp(name, ".p2align") == 0 ||
+			   strcmp(name, ".balign") == 0 ||
+			   strcmp(name, ".align") == 0) {
+		// .align is the same as .balign on x86.
+		int power_of_two = strcmp(name, ".p2align") == 0;
 		token_next();
-		directive->immediate.value = 0;
-		directive->immediate.str = 0;
-		if (tokens[0].type == T_NUMBER) {
-			directive->immediate.value = tokens[0].immediate;
-		} else if (tokens[0].type == T_IDENTIFIER) {
-			directive->immediate.str = tokens[0].identifier;
-		} else {
-			ERROR("Expected number on line %d", tokens[0].line);
+		directive->type = DIR_ALIGN;
+		directive->align.alignment = parse_constant();
+		if (power_of_two)
+			directive->align.alignment = (uint64_t)1 << directive->align.alignment;
+		directive->align.has_fill = 0;
+		directive->align.fill = 0;
+		directive->align.max = 0;
+
+		// Both the fill and max arguments are optional, as in ".p2align 4,,10".
+		if (token_accept(T_COMMA)) {
+			if (tokens[0].type != T_COMMA && tokens[0].type != T_NEWLINE) {
+				directive->align.has_fill = 1;
+				directive->align.fill = parse_constant();
+			}
+
+			if (token_accept(T_COMMA))
+				directive->align.max = parse_constant();
 		}
-		directive->type = DIR_QUAD;
-		token_next();
+
 		token_expect(T_NEWLINE);
 		return 1;
-	} else if (strcmp(name, ".byte") == 0) {
+	}
+
+	// Directives taking a single symbol.
+	static const struct {
+		const char *name;
+		int type;
+	} symbol_directives[] = {
+		{ ".global", DIR_GLOBAL },
+		{ ".globl", DIR_GLOBAL },
+		{ ".addrsig_sym", DIR_ADDRSIG },
+		{ ".hidden", DIR_HIDDEN },
+		{ ".protected", DIR_PROTECTED },
+		{ ".internal", DIR_INTERNAL },
+	};
+
+	for (unsigned i = 0; i < sizeof symbol_directives / sizeof *symbol_directives; i++) {
+		if (strcmp(name, symbol_directives[i].name) != 0)
+			continue;
+
 		token_next();
-		directive->immediate.value = 0;
-		directive->immediate.str = 0;
-		if (tokens[0].type == T_NUMBER) {
-			directive->immediate.value = tokens[0].immediate;
-		} else if (tokens[0].type == T_IDENTIFIER) {
-			directive->immediate.str = tokens[0].identifier;
-		} else {
-			ERROR("Expected number on line %d", tokens[0].line);
-		}
-		directive->type = DIR_BYTE;
+		if (tokens[0].type != T_IDENTIFIER)
+			ERROR("Expected identifer on line %d", tokens[0].line);
+		directive->type = symbol_directives[i].type;
+		directive->name = tokens[0].identifier;
+		token_next();
+		token_expect(T_NEWLINE);
+		return 1;
+	}
+
+	static const struct {
+		const char *name;
+		int type;
+	} data_directives[] = {
+		{ ".quad", DIR_QUAD },
+		{ ".long", DIR_LONG },
+		{ ".int", DIR_LONG },
+		{ ".value", DIR_WORD },
+		{ ".word", DIR_WORD },
+		{ ".short", DIR_WORD },
+		{ ".byte", DIR_BYTE },
+	};
+
+	for (unsigned i = 0; i < sizeof data_directives / sizeof *data_directives; i++) {
+		if (strcmp(name, data_directives[i].name) != 0)
+			continue;
+
 		token_next();
+		directive->type = data_directives[i].type;
+		parse_expression(&directive->immediate);
 		token_expect(T_NEWLINE);
 		return 1;
 	}
@@ -23,9 +23,32 @@ enum reg {
 
 	REG_NONE,
 
+	REG_RIP,
+	REG_FS,
+	REG_GS,
+
 	REG_MAX
 };
 
+// Relocation modifiers, as in sym@PLT.
+enum modifier {
+	MOD_NONE,
+	MOD_PLT,
+	MOD_GOTPCREL,
+	MOD_TPOFF,
+	MOD_GOTTPOFF,
+	MOD_TLSGD,
+	MOD_TLSLD,
+	MOD_DTPOFF
+};
+
+// Value of the form str - sub + value, where both symbols are optional.
+struct expression {
+	char *str, *sub;
+	uint64_t value;
+	enum modifier modifier;
+};
+
 struct operand {
 	enum {
 		O_EMPTY,
@@ -47,17 +70,21 @@ struct operand {
 			enum reg index, base;
 			int scale;
 			uint64_t offset;
+			char *str, *sub; // Symbolic displacement, offset is the addend.
+			enum modifier modifier;
+			enum reg segment;
 		} sib;
 
-		struct {
-			char *str;
-			uint64_t value;
-		} imm;
+		struct expression imm;
 	};
 };
 
+#define MAX_PREFIXES 4
+
 struct instruction {
 	const char *mnemonic;
+	uint8_t prefixes[MAX_PREFIXES]; // Explicit prefix bytes, in source order.
+	int n_prefixes;
 	struct operand operands[4];
 };
 
@@ -65,6 +92,49 @@ struct label {
 	const char *name;
 };
 
+struct loc {
+	int file, line, column;
+	int is_stmt; // -1 if not given.
+	int basic_block, prologue_end, epilogue_begin;
+	unsigned discriminator;
+};
+
+struct cfi {
+	enum {
+		CFI_STARTPROC,
+		CFI_ENDPROC,
+		CFI_DEF_CFA,
+		CFI_DEF_CFA_REGISTER,
+		CFI_DEF_CFA_OFFSET,
+		CFI_ADJUST_CFA_OFFSET,
+		CFI_OFFSET,
+		CFI_REL_OFFSET,
+		CFI_REGISTER,
+		CFI_RESTORE,
+		CFI_UNDEFINED,
+		CFI_SAME_VALUE,
+		CFI_REMEMBER_STATE,
+		CFI_RESTORE_STATE,
+		CFI_ESCAPE,
+		CFI_PERSONALITY,
+		CFI_LSDA,
+		CFI_SIGNAL_FRAME,
+		CFI_SECTIONS
+	} type;
+
+	int regs[2]; // DWARF register numbers.
+	int64_t offset;
+	int simple; // .cfi_startproc simple, without the initial instructions.
+
+	// .cfi_personality and .cfi_lsda, symbol is NULL for DW_EH_PE_omit.
+	int encoding;
+	const char *symbol;
+
+	// .cfi_escape
+	uint8_t *bytes;
+	int n_bytes;
+};
+
 struct directive {
 	enum {
 		DIR_SECTION,
@@ -72,16 +142,63 @@ struct directive {
 		DIR_STRING,
 		DIR_ZERO,
 		DIR_QUAD,
-		DIR_BYTE
+		DIR_LONG,
+		DIR_WORD,
+		DIR_BYTE,
+		DIR_ALIGN,
+		DIR_ADDRSIG,
+		DIR_COMM,
+		DIR_LCOMM,
+		DIR_TYPE,
+		DIR_SIZE,
+		DIR_HIDDEN,
+		DIR_PROTECTED,
+		DIR_INTERNAL,
+		DIR_FILE,
+		DIR_LOC,
+		DIR_CFI
 	} type;
 
 	union {
 		const char *name;
 
+		struct expression immediate;
+
+		struct {
+			uint64_t alignment, max;
+			int has_fill;
+			uint8_t fill;
+		} align;
+
+		struct {
+			const char *name;
+			uint64_t size, alignment; // alignment is 0 if not given.
+		} common;
+
+		struct {
+			const char *name;
+			const char *flags, *type; // NULL if not given.
+			uint64_t entsize;
+		} section;
+
+		struct {
+			const char *name;
+			const char *type; // Without the @, as in function.
+		} symbol_type;
+
 		struct {
-			uint64_t value;
-			char *str;
-		} immediate;
+			const char *name;
+			struct expression size;
+		} symbol_size;
+
+		struct {
+			int number; // -1 for .file "name", which only names the object.
+			const char *dir, *name; // dir is NULL if not given.
+		} file;
+
+		struct loc loc;
+
+		struct cfi cfi;
 	};
 };
 
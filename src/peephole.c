@@ -0,0 +1,310 @@
+#include "peephole.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ERROR(STR, ...) do { printf("Error on line %d file %s: \"" STR "\"\n", __LINE__, __FILE__, ##__VA_ARGS__); exit(1); } while(0)
+
+// Longest pattern plus one instruction of lookahead.
+#define WINDOW 3
+
+// Entries of the window are either instructions or labels.
+// A label has no mnemonic, and its name as an O_IMM_ABSOLUTE operand,
+// which makes it compare equal to a branch target.
+static struct instruction window[WINDOW];
+static int n_window = 0;
+
+static void (*output_instruction)(struct instruction *);
+static void (*output_label)(const char *);
+
+// Operand patterns, operands are in AT&T order.
+enum {
+	P_NONE,
+	P_REG,
+	P_IMM, // Constant immediate.
+	P_ZERO,
+	P_TARGET // Symbol, as in jmp label.
+};
+
+#define LABEL NULL
+
+enum {
+	C_FLAGS_DEAD = 1 // Flags are overwritten by the instruction following the match.
+};
+
+struct same {
+	int entry_a, operand_a;
+	int entry_b, operand_b;
+};
+
+struct rule {
+	const char *name;
+	int length;
+	struct {
+		const char *mnemonic;
+		int operands[2];
+	} pattern[2];
+	struct same same[2];
+	int n_same;
+	int conditions;
+
+	// Writes the replacement to out and returns its length, or -1 to reject the match.
+	int (*rewrite)(struct instruction *in, struct instruction *out);
+	int hits;
+};
+
+static int drop_all(struct instruction *in, struct instruction *out);
+static int keep_label(struct instruction *in, struct instruction *out);
+static int push_pop_to_mov(struct instruction *in, struct instruction *out);
+static int mov_zero_to_xor(struct instruction *in, struct instruction *out);
+static int mov_add_to_lea(struct instruction *in, struct instruction *out);
+static int fold_mov_add(struct instruction *in, struct instruction *out);
+
+static struct rule rules[] = {
+	{ "mov-to-self", 1, {{"movq", {P_REG, P_REG}}},
+	  .same = {{0, 0, 0, 1}}, .n_same = 1, .rewrite = drop_all },
+	{ "push-pop-same", 2, {{"pushq", {P_REG}}, {"popq", {P_REG}}},
+	  .same = {{0, 0, 1, 0}}, .n_same = 1, .rewrite = drop_all },
+	{ "push-pop-to-mov", 2, {{"pushq", {P_REG}}, {"popq", {P_REG}}},
+	  .rewrite = push_pop_to_mov },
+	{ "jmp-to-next", 2, {{"jmp", {P_TARGET}}, {LABEL}},
+	  .same = {{0, 0, 1, 0}}, .n_same = 1, .rewrite = keep_label },
+	{ "fold-mov-add", 2, {{"movq", {P_IMM, P_REG}}, {"addq", {P_IMM, P_REG}}},
+	  .same = {{0, 1, 1, 1}}, .n_same = 1, .conditions = C_FLAGS_DEAD, .rewrite = fold_mov_add },
+	{ "mov-add-to-lea", 2, {{"movq", {P_REG, P_REG}}, {"addq", {P_IMM, P_REG}}},
+	  .same = {{0, 1, 1, 1}}, .n_same = 1, .conditions = C_FLAGS_DEAD, .rewrite = mov_add_to_lea },
+	{ "movq-zero-to-xor", 1, {{"movq", {P_ZERO, P_REG}}},
+	  .conditions = C_FLAGS_DEAD, .rewrite = mov_zero_to_xor },
+	{ "movl-zero-to-xor", 1, {{"movl", {P_ZERO, P_REG}}},
+	  .conditions = C_FLAGS_DEAD, .rewrite = mov_zero_to_xor },
+};
+
+#define N_RULES (sizeof rules / sizeof *rules)
+
+static int is_constant(struct expression *expr) {
+	return !expr->str && !expr->sub && expr->modifier == MOD_NONE;
+}
+
+static int fits_imm32(int64_t value) {
+	return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static int operand_equal(struct operand *a, struct operand *b) {
+	if (a->type != b->type)
+		return 0;
+
+	switch (a->type) {
+	case O_REG:
+	case O_REG_STAR:
+		return a->reg.reg == b->reg.reg && a->reg.size == b->reg.size &&
+			a->reg.rex == b->reg.rex;
+	case O_IMM:
+	case O_IMM_ABSOLUTE:
+		return a->imm.value == b->imm.value && a->imm.modifier == b->imm.modifier &&
+			(a->imm.str == b->imm.str || (a->imm.str && b->imm.str && strcmp(a->imm.str, b->imm.str) == 0)) &&
+			(a->imm.sub == b->imm.sub || (a->imm.sub && b->imm.sub && strcmp(a->imm.sub, b->imm.sub) == 0));
+	default:
+		return 0;
+	}
+}
+
+static int operand_matches(struct operand *operand, int pattern) {
+	switch (pattern) {
+	case P_NONE: return operand->type == O_EMPTY;
+	case P_REG: return operand->type == O_REG;
+	case P_IMM: return operand->type == O_IMM && is_constant(&operand->imm);
+	case P_ZERO: return operand->type == O_IMM && is_constant(&operand->imm) && operand->imm.value == 0;
+	case P_TARGET: return operand->type == O_IMM_ABSOLUTE && operand->imm.str && !operand->imm.sub &&
+			operand->imm.value == 0 && operand->imm.modifier == MOD_NONE;
+	default: return 0;
+	}
+}
+
+static int entry_matches(struct instruction *instruction, const char *mnemonic, const int operands[2]) {
+	if (!mnemonic || !instruction->mnemonic)
+		return mnemonic == instruction->mnemonic;
+
+	if (instruction->n_prefixes || strcmp(instruction->mnemonic, mnemonic) != 0)
+		return 0;
+
+	for (int i = 0; i < 2; i++)
+		if (!operand_matches(instruction->operands + i, operands[i]))
+			return 0;
+	return instruction->operands[2].type == O_EMPTY;
+}
+
+// Instructions that write all arithmetic flags without reading them.
+// Calls and returns are included, flags are not preserved across them in the ABI.
+static int writes_flags(struct instruction *entry) {
+	static const char *mnemonics[] = {
+		"cmpb", "cmpw", "cmpl", "cmpq", "testb", "testw", "testl", "testq",
+		"addl", "addq", "subl", "subq", "andl", "andq", "xor", "xorl", "xorq",
+		"callq", "ret",
+	};
+
+	const char *mnemonic = entry->mnemonic;
+	if (!mnemonic)
+		return 0;
+
+	for (unsigned i = 0; i < sizeof mnemonics / sizeof *mnemonics; i++)
+		if (strcmp(mnemonic, mnemonics[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static int rule_matches(struct rule *rule) {
+	if (rule->length > n_window)
+		return 0;
+
+	for (int i = 0; i < rule->length; i++)
+		if (!entry_matches(window + i, rule->pattern[i].mnemonic, rule->pattern[i].operands))
+			return 0;
+
+	for (int i = 0; i < rule->n_same; i++) {
+		struct same *s = rule->same + i;
+		if (!operand_equal(window[s->entry_a].operands + s->operand_a,
+						   window[s->entry_b].operands + s->operand_b))
+			return 0;
+	}
+
+	if ((rule->conditions & C_FLAGS_DEAD) &&
+		(rule->length >= n_window || !writes_flags(window + rule->length)))
+		return 0;
+
+	return 1;
+}
+
+static int apply_rules(void) {
+	for (unsigned i = 0; i < N_RULES; i++) {
+		struct rule *rule = rules + i;
+		if (!rule_matches(rule))
+			continue;
+
+		struct instruction out[WINDOW];
+		int n_out = rule->rewrite(window, out);
+		if (n_out < 0)
+			continue;
+
+		int rest = n_window - rule->length;
+		memmove(window + n_out, window + rule->length, rest * sizeof *window);
+		memcpy(window, out, n_out * sizeof *window);
+		n_window = n_out + rest;
+		rule->hits++;
+		return 1;
+	}
+	return 0;
+}
+
+static void emit_first(void) {
+	struct instruction *instruction = window;
+	if (instruction->mnemonic)
+		output_instruction(instruction);
+	else
+		output_label(instruction->operands[0].imm.str);
+
+	n_window--;
+	memmove(window, window + 1, n_window * sizeof *window);
+}
+
+// Rules are only tried at the start of a full window, so conditions
+// looking past the match always see the following entry if there is one.
+static void run(int flush) {
+	while (n_window == WINDOW || (flush && n_window > 0)) {
+		if (!apply_rules())
+			emit_first();
+	}
+}
+
+static void push(struct instruction *entry) {
+	if (n_window == WINDOW)
+		ERROR("Peephole window overflow");
+	window[n_window++] = *entry;
+	run(0);
+}
+
+void peephole_init(void (*output_instruction_)(struct instruction *), void (*output_label_)(const char *)) {
+	output_instruction = output_instruction_;
+	output_label = output_label_;
+}
+
+void peephole_instruction(struct instruction *instruction) {
+	push(instruction);
+}
+
+void peephole_label(const char *name) {
+	struct instruction entry = { 0 };
+	entry.operands[0].type = O_IMM_ABSOLUTE;
+	entry.operands[0].imm.str = (char *)name;
+	push(&entry);
+}
+
+void peephole_flush(void) {
+	run(1);
+}
+
+void peephole_print_statistics(void) {
+	for (unsigned i = 0; i < N_RULES; i++)
+		if (rules[i].hits)
+			fprintf(stderr, "Peephole: %s: %d\n", rules[i].name, rules[i].hits);
+}
+
+static struct operand reg_operand(enum reg reg, int size) {
+	struct operand operand = { .type = O_REG };
+	operand.reg.reg = reg;
+	operand.reg.size = size;
+	operand.reg.rex = 0;
+	return operand;
+}
+
+static int drop_all(struct instruction *in, struct instruction *out) {
+	return 0;
+}
+
+// jmp label; label: -> label:
+static int keep_label(struct instruction *in, struct instruction *out) {
+	out[0] = in[1];
+	return 1;
+}
+
+// pushq %a; popq %b -> movq %a, %b
+static int push_pop_to_mov(struct instruction *in, struct instruction *out) {
+	out[0] = (struct instruction) { .mnemonic = "movq", .operands = {
+				in[0].operands[0], in[1].operands[0] } };
+	return 1;
+}
+
+// movq $0, %r -> xorl %r32, %r32
+static int mov_zero_to_xor(struct instruction *in, struct instruction *out) {
+	struct operand reg = reg_operand(in[0].operands[1].reg.reg, 4);
+	out[0] = (struct instruction) { .mnemonic = "xorl", .operands = { reg, reg } };
+	return 1;
+}
+
+// movq %a, %b; addq $imm, %b -> leaq imm(%a), %b
+static int mov_add_to_lea(struct instruction *in, struct instruction *out) {
+	int64_t offset = in[1].operands[0].imm.value;
+	if (!fits_imm32(offset))
+		return -1;
+
+	struct operand sib = { .type = O_SIB };
+	sib.sib.base = in[0].operands[0].reg.reg;
+	sib.sib.index = REG_NONE;
+	sib.sib.scale = 1;
+	sib.sib.offset = offset;
+	sib.sib.segment = REG_NONE;
+
+	out[0] = (struct instruction) { .mnemonic = "leaq", .operands = { sib, in[1].operands[1] } };
+	return 1;
+}
+
+// movq $a, %r; addq $b, %r -> movq $(a + b), %r
+static int fold_mov_add(struct instruction *in, struct instruction *out) {
+	int64_t value = in[0].operands[0].imm.value + in[1].operands[0].imm.value;
+	if (!fits_imm32(value))
+		return -1;
+
+	out[0] = in[0];
+	out[0].operands[0].imm.value = value;
+	return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+// Peephole optimizer working on a small window of parsed instructions
+// and labels, before they reach the encoder.
+
+#include "parser.h"
+
+void peephole_init(void (*output_instruction)(struct instruction *), void (*output_label)(const char *));
+void peephole_instruction(struct instruction *instruction);
+void peephole_label(const char *name);
+void peephole_flush(void);
+void peephole_print_statistics(void);
+
+#endif
@@ -0,0 +1,26 @@
+# Alignment padding with multi-byte NOPs in code, zeros in data, and the
+# largest alignment becomes the section alignment.
+# dump: objdump -d -w -s -j .text -j .data $o; objdump -h $o | awk '/ \.(text|data)/ { print $2, $3, $7 }'
+	.section .text
+	ret
+	.p2align 4
+	ret
+	.p2align 3
+	pushq %rax
+	.p2align 4
+	.balign 32
+	ret
+	.align 16
+	movq %rax, %rbx
+	.p2align 5
+	ret
+	.p2align 4,,10
+	ret
+	.p2align 4,,3
+	ret
+	.section .data
+	.byte 1
+	.p2align 3
+	.quad 2
+	.balign 64
+	.byte 3
@@ -0,0 +1,31 @@
+# Locked read-modify-write instructions and memory fences.
+	.section .text
+	lock addq $1, (%rdi)
+	lock addq %rax, 8(%rdi)
+	lock addl $-1, (%rsi)
+	lock incl (%rdi)
+	lock incq 16(%rsp)
+	lock decl (%r8)
+	lock decq (%rax,%rcx,8)
+	lock cmpxchgb %cl, (%rdi)
+	lock cmpxchgw %cx, (%rdi)
+	lock cmpxchgl %ecx, (%rdi)
+	lock cmpxchgq %r9, (%r10)
+	lock cmpxchg8b (%rdi)
+	lock cmpxchg16b (%rdi)
+	lock xaddb %al, (%rdi)
+	lock xaddw %ax, (%rdi)
+	lock xaddl %eax, (%rdi)
+	lock xaddq %rax, (%rdi)
+	xchgb %al, (%rdi)
+	xchgw (%rdi), %ax
+	xchgl %eax, (%rdi)
+	xchgq %rax, (%rdi)
+	lock xchgq (%rdi), %rax
+	lock xchgq %rax, (%rdi)
+	lock incl counter
+	lock addl $1, counter
+	mfence
+	lfence
+	sfence
+	pause
@@ -0,0 +1,24 @@
+# as: --auto-size
+# dump: readelf -W -s $o | awk 'NR > 3 && $8 !~ /^\./ { print $3, $4, $5, $8 }'
+# Global labels without .size run to the next global label or the end of
+# the section. An explicit .size is kept.
+	.text
+	.globl a
+a:
+	xorl %eax, %eax
+local:
+	ret
+	.globl b
+b:
+	ret
+	.globl c
+	.type c, @function
+c:
+	ret
+	ret
+	.size c, 1
+	.data
+	.globl d
+d:
+	.quad 0
+	.long 0
@@ -0,0 +1,41 @@
+# Bit scan and count, bswap, BMI1 and BMI2.
+	.section .text
+	bsfw %ax, %cx
+	bsfl (%rdi), %eax
+	bsfq %r8, %r9
+	bsrw %r10w, %r11w
+	bsrl %ecx, %edx
+	bsrq 8(%rsp), %rax
+	tzcntw %ax, %cx
+	tzcntl %r12d, %eax
+	tzcntq (%rax,%rbx,8), %r15
+	lzcntw %si, %di
+	lzcntl %eax, %ecx
+	lzcntq %r13, %rax
+	popcntw %dx, %ax
+	popcntl 4(%rbp), %r9d
+	popcntq %rax, %rbx
+	bswapl %eax
+	bswapl %r10d
+	bswapq %rcx
+	bswapq %r15
+	andnl %eax, %ecx, %edx
+	andnq (%rdi), %r8, %r9
+	blsrl %eax, %ecx
+	blsrq %r11, %rax
+	blsmskl (%rsi), %edx
+	blsmskq %rax, %r12
+	blsil %ecx, %eax
+	blsiq %r14, %r13
+	shlxl %eax, %ecx, %edx
+	shlxq %r8, (%rdi), %rax
+	shrxl %ecx, %eax, %r9d
+	shrxq %rax, %rbx, %rcx
+	sarxl %edx, %esi, %edi
+	sarxq %r15, %r14, %r13
+	pdepl %eax, %ecx, %edx
+	pdepq (%rdi), %rax, %rbx
+	pextl %r8d, %r9d, %r10d
+	pextq %rcx, %rdx, %rax
+	rorxl $3, %eax, %ecx
+	rorxq $63, (%rdi), %r11
@@ -0,0 +1,35 @@
+# dump: readelf --debug-dump=frames $o | grep -v "^$\|^Contents"; objdump -r -w -j .eh_frame $o | grep R_X86
+	.text
+	.globl f
+f:
+	.cfi_startproc
+	pushq %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
+	movq %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+	.cfi_remember_state
+	popq %rbp
+	.cfi_def_cfa %rsp, 8
+	ret
+	.cfi_restore_state
+	popq %rbp
+	.cfi_restore %rbp
+	.cfi_def_cfa_offset 8
+	ret
+	.cfi_endproc
+	.globl g
+g:
+	.cfi_startproc
+	subq $24, %rsp
+	.cfi_adjust_cfa_offset 24
+	addq $24, %rsp
+	.cfi_adjust_cfa_offset -24
+	ret
+	.cfi_endproc
+	.globl h
+h:
+	.cfi_startproc
+	.cfi_signal_frame
+	ret
+	.cfi_endproc
@@ -0,0 +1,15 @@
+# .bss and .lcomm take no file space, .comm makes SHN_COMMON symbols
+# whose value is their alignment.
+# dump: readelf -W -S $o | grep "bss\|Nr"; readelf -W -s $o | tail -n +4
+	.text
+	movq buf(%rip), %rax
+	movq shared(%rip), %rcx
+	.bss
+	.p2align 4
+buf:
+	.zero 4096
+	.comm shared, 64, 32
+	.lcomm local, 10
+	.globl zeros
+zeros:
+	.zero 16
@@ -0,0 +1,29 @@
+# Constant folding, symbol plus offset and symbol differences.
+# dump: objdump -s -r -j .text -j .data $o
+	.section .text
+a:
+	movq $(1 << 12) + 3 * 4, %rax
+	movl $~0xff & 0xffff, %ecx
+	movq $-(2 + 3), %rdx
+	movq x + 8(%rip), %rax
+	leaq b - a(%rcx), %rdx
+	movq $x + 4, %rsi
+	ret
+b:
+	.byte b - a
+	.byte a - a
+	.value c - a
+	.long c - b + 1
+	.quad c - a
+c:
+	.section .data
+x:
+	.quad a + 8
+	.quad b - a
+	.quad c - x
+	.long 10 % 4
+	.long 0x1234 >> 4
+	.long 6 | 9 ^ 3
+	.byte -1
+	.byte 255
+	.byte -128
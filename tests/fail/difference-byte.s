@@ -0,0 +1,6 @@
+# A difference that does not fit its field is an error.
+	.section .text
+a:
+	.zero 300
+b:
+	.byte b - a
@@ -0,0 +1,6 @@
+# A difference that does not fit its field is an error.
+	.section .text
+a:
+	.zero 70000
+b:
+	.value b - a
@@ -0,0 +1,3 @@
+# lock is only valid on read-modify-write instructions.
+	.section .text
+	lock movq %rax, (%rdi)
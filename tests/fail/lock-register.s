@@ -0,0 +1,3 @@
+# lock needs a memory operand.
+	.section .text
+	lock addq %rax, %rbx
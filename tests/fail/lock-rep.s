@@ -0,0 +1,3 @@
+# lock and rep exclude each other.
+	.section .text
+	lock rep movsb
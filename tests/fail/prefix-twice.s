@@ -0,0 +1,3 @@
+# A prefix can only be given once.
+	.section .text
+	data16 data16 rex64 callq f@PLT
@@ -0,0 +1,29 @@
+# Local labels and labels that code falls through to stay in the function
+# around them, so --icf never folds only the tail of a function.
+# as: --icf
+# dump: objdump -d -r -w $o; objdump -t $o | grep " g " | sort
+	.section .text
+	.globl f
+f:
+	movl $1, %eax
+tail1:
+	addl $2, %eax
+	ret
+	.globl g
+g:
+	movl $7, %eax
+tail2:
+	addl $2, %eax
+	ret
+	.globl h
+h:
+	movl $7, %eax
+	.globl tail3
+tail3:
+	addl $2, %eax
+	ret
+	.globl i
+	.type i, @function
+i:
+	addl $2, %eax
+	ret
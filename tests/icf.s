@@ -0,0 +1,34 @@
+# --icf folds identical functions, including ones with equal relocations,
+# but not functions marked with .addrsig_sym.
+# as: --icf
+# dump: objdump -d -r -w $o; objdump -t $o | grep " g " | sort
+	.section .text
+	.globl a
+a:
+	movq $1, %rax
+	ret
+	.globl b
+b:
+	movq $1, %rax
+	ret
+	.globl c
+c:
+	movq $2, %rax
+	ret
+	.globl d
+d:
+	callq a
+	ret
+	.globl e
+e:
+	callq a
+	ret
+	.globl f
+f:
+	callq b
+	ret
+	.globl g
+g:
+	movq $2, %rax
+	ret
+	.addrsig_sym g
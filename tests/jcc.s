@@ -0,0 +1,29 @@
+# -mbranches-within-32B-boundaries: no jump, call, return or fused
+# cmp/jcc pair may cross or end on a 32 byte boundary.
+# as: -mbranches-within-32B-boundaries
+	.section .text
+f:
+	movq $1, %rax
+	movq $2, %rcx
+	movq $3, %rdx
+	movq $4, %rsi
+	cmpq %rax, %rbx
+	je f
+	movl $5, %eax
+	movl $6, %eax
+	movl $7, %eax
+	movl $9, %ecx
+	callq g
+	movq $1, %rax
+	movq $2, %rcx
+	movq $3, %rdx
+	movq $4, %rdi
+	testq %rax, %rax
+	je f
+	movq $1, %rax
+	movq $2, %rcx
+	movq $3, %rdx
+	movq $3, %rdx
+	ret
+g:
+	jmp f
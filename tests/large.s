@@ -0,0 +1,16 @@
+# A section that grows past 1 MiB moves to a reserved range once.
+# References patched into it afterwards must land in the moved data.
+# dump: objdump -d -r -w --stop-address=0x10 $o; objdump -d -r -w --start-address=0x10c8ec $o | tail -n +6; objdump -h $o | awk '/ \.(text|data)/ { print $2, $3 }'
+	.section .text
+f:
+	leaq g(%rip), %rax
+	jmp g
+	.zero 1100000
+g:
+	callq f
+	leaq f(%rip), %rcx
+	.long g - f
+	.quad end - f
+end:
+	.section .data
+	.quad g
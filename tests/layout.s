@@ -0,0 +1,12 @@
+# Section contents, headers and gaps larger than the zero page all go
+# through the gathered writer. The checksum pins the whole file.
+# dump: readelf -W -S $o | grep "^ *\["; objdump -s -j .text -j .data $o | tail -n +3; cksum < $o
+	.section .text
+	movq $1, %rax
+	ret
+	.section .data
+	.balign 16384
+x:
+	.quad 0x1122334455667788
+	.section .bss
+	.zero 100000
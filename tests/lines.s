@@ -0,0 +1,16 @@
+# dump: objdump --dwarf=decodedline $o | grep -v "^$\|^Contents\|^CU:\|^File name"
+	.file 1 "main.c"
+	.file 2 "util.h"
+	.text
+	.globl main
+main:
+	.loc 1 3 5
+	xorl %eax, %eax
+	.loc 2 10 1
+	addl $1, %eax
+	.loc 1 4 0
+	ret
+	.section .text.other, "ax"
+other:
+	.loc 1 20 3
+	ret
@@ -0,0 +1,25 @@
+# dump: objdump -d -r -w $o; objdump -r -w -s -j .rodata $o
+# Branches to local labels in the same section need no relocation. Global
+# labels, other sections and absolute references keep theirs.
+	.text
+start:
+	jmp forward
+	je start
+	callq forward
+	leaq forward(%rip), %rax
+	leaq .Lconst(%rip), %rcx
+	callq global
+	callq other
+	movq $forward, %rax
+forward:
+	ret
+	.globl global
+global:
+	ret
+	.section .text.other, "ax"
+other:
+	jmp start
+	.section .rodata
+.Lconst:
+	.quad forward
+	.long forward - start
@@ -0,0 +1,3 @@
+# Assembles locals.s with -L, which keeps the .L labels.
+echo "# as: -L"
+cat locals.s
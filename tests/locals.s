@@ -0,0 +1,22 @@
+# dump: objdump -r -w $o | grep R_X86; readelf -W -s $o | awk 'NR > 3 { print $4, $5, $7, $8 }'
+# Relocations against local symbols use the section symbol, .L labels are
+# dropped, and the mergeable section keeps its symbol for a non-zero addend.
+	.text
+local:
+	jmp .Ldone
+.Ldone:
+	ret
+	.section .rodata.str1.1, "aMS", @progbits, 1
+.Lhello:
+	.string "hello"
+.Lworld:
+	.string "world"
+	.data
+	.quad local
+	.quad .Ldone
+	.quad .Lhello
+	.quad .Lworld + 1
+	.quad .Lunused
+	.section .rodata
+.Lunused:
+	.quad 0
@@ -0,0 +1,8 @@
+# Prints enough sections that the section count and the section indices of
+# symbols no longer fit in 16 bits.
+echo "# dump: readelf -W -h \$o | grep \"section headers\\\\|string table index\"; readelf -W -s \$o | grep \" f[0-9]*\$\" | awk 'NR % 16384 == 1 || \$8 == \"f65299\" { print \$7, \$8 }'"
+i=0
+while [ $i -lt 65300 ]; do
+	printf '\t.section .text.f%d, "ax"\n\t.globl f%d\nf%d:\n\tret\n' $i $i $i
+	i=$((i + 1))
+done
@@ -0,0 +1,18 @@
+# -Os narrows 64-bit register operations when the result and flags are
+# the same, and picks the shortest immediate form.
+# as: -Os
+	.section .text
+	movq $5, %rax
+	movq $0xffffffff, %r9
+	movq $-1, %rax
+	movq $x, %rcx
+	andq $0xff, %rdx
+	andq $-16, %rsp
+	xorq %rax, %rax
+	xorq %r12, %r12
+	subq %rcx, %rcx
+	xorq %rax, %rbx
+	addq $8, %rax
+	addq $1000, %rax
+	addl $1000, %eax
+	andl $7, %ecx
@@ -0,0 +1,23 @@
+# Local labels and labels that code falls through to move with the function
+# around them.
+# as: --symbol-ordering-file order-labels.txt
+	.section .text
+	.globl f
+f:
+	movl $1, %eax
+tail1:
+	addl $2, %eax
+	ret
+	.globl g
+g:
+	movl $7, %eax
+tail2:
+	addl $2, %eax
+	ret
+	.type h, @function
+h:
+	movl $3, %eax
+	.globl tail3
+tail3:
+	je tail2
+	ret
@@ -0,0 +1,22 @@
+# --symbol-ordering-file lays out listed functions first, in order, and
+# keeps the alignment of each function within the section alignment.
+# as: --symbol-ordering-file order.txt
+	.section .text
+	.globl a
+	.p2align 4
+a:
+	callq d
+	ret
+	.globl b
+	.p2align 4
+b:
+	movq $1, %rax
+	ret
+	.globl c
+c:
+	jmp b
+	.globl d
+	.p2align 4
+d:
+	leaq a(%rip), %rax
+	ret
@@ -0,0 +1,27 @@
+# One case per peephole rule, and cases that must be left alone.
+# as: --peephole
+	.section .text
+f:
+	movq %rax, %rax
+	pushq %rbx
+	popq %rbx
+	pushq %rcx
+	popq %rdx
+	jmp .L1
+.L1:
+	movq $1, %rax
+	addq $2, %rax
+	cmpq %rax, %rbx
+	movq %rsi, %rdi
+	addq $16, %rdi
+	testq %rdi, %rdi
+	movq $0, %rcx
+	cmpq %rcx, %rdx
+	movl $0, %edx
+	testl %edx, %edx
+	# Flags are live after these, they must stay as they are.
+	movq $0, %rax
+	movq %rsi, %rdi
+	addq $16, %rdi
+	je f
+	ret
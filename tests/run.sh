@@ -0,0 +1,70 @@
+#!/bin/sh
+# Assembles every tests/*.s and compares a dump of the object file with the
+# .expected file next to it. Tests named *.sh print their input instead.
+# A test can set the options and the dump command in its first lines:
+#   # as: -ffunction-sections
+#   # dump: readelf -W -S $o
+# The object file is $o, the default dump is objdump -d -r -w.
+# Tests in tests/fail/ pass if the assembler rejects them.
+# With -u, the .expected files are rewritten from the current output.
+
+# Tests run in the tests directory, so options can name files next to them.
+cd "$(dirname "$0")" || exit 1
+AS=${AS:-../as}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+update=0
+[ "$1" = "-u" ] && update=1
+
+failed=0
+total=0
+
+for test in *.s *.sh; do
+	[ -f "$test" ] || continue
+	[ "$test" = run.sh ] && continue
+	name=${test%.*}
+	total=$((total + 1))
+
+	input=$test
+	case $test in
+	*.sh)
+		input=$TMP/input.s
+		sh "$test" > "$input"
+		;;
+	esac
+
+	options=$(sed -n 's/^# as: //p' "$input")
+	dump=$(sed -n 's/^# dump: //p' "$input")
+	[ -n "$dump" ] || dump='objdump -d -r -w $o'
+
+	o=$TMP/test.o
+	if ! $AS $options "$input" "$o" > "$TMP/log" 2>&1; then
+		echo "FAIL $test: assembler failed"
+		cat "$TMP/log"
+		failed=$((failed + 1))
+		continue
+	fi
+
+	eval "$dump" 2>&1 | grep -v "file format" > "$TMP/out"
+	if [ $update = 1 ]; then
+		cp "$TMP/out" "$name.expected"
+	elif ! diff -u "$name.expected" "$TMP/out" > "$TMP/diff"; then
+		echo "FAIL $test"
+		cat "$TMP/diff"
+		failed=$((failed + 1))
+	fi
+done
+
+for test in fail/*.s; do
+	[ -f "$test" ] || continue
+	total=$((total + 1))
+	options=$(sed -n 's/^# as: //p' "$test")
+	if $AS $options "$test" "$TMP/test.o" > /dev/null 2>&1; then
+		echo "FAIL $test: accepted invalid input"
+		failed=$((failed + 1))
+	fi
+done
+
+echo "$((total - failed))/$total tests passed"
+[ $failed = 0 ]
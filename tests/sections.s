@@ -0,0 +1,27 @@
+# Section types, flags and entry sizes, from defaults and from .section.
+# dump: readelf -W -S $o | sed -n 's/^ *\[ *[0-9]*\] //p' | sed 's/ [0-9a-f]\{16\} [0-9a-f]\{6\} [0-9a-f]\{6\}//'
+	.text
+	ret
+	.section .rodata
+	.byte 1
+	.section .rodata.str1.1,"aMS",@progbits,1
+	.string "hello"
+	.section .rodata.cst8,"aM",@progbits,8
+	.quad 1
+	.section .rodata.str4.4
+	.long 0
+	.section .init_array,"aw"
+	.quad 0
+	.section .fini_array
+	.quad 0
+	.section .note.GNU-stack,"",@progbits
+	.section .tdata,"awT",@progbits
+	.long 1
+	.section .tbss,"awT",@nobits
+	.zero 4
+	.section ".my section","ax",@progbits
+	ret
+	.section .excluded,"e"
+	.byte 0
+	.section .note.test,"a",@note
+	.long 0
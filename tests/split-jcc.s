@@ -0,0 +1,19 @@
+# Split code padded for -mbranches-within-32B-boundaries keeps each
+# function's offset within 32 bytes, in a section aligned to 32.
+# as: -mbranches-within-32B-boundaries -ffunction-sections
+# dump: objdump -d -w $o; objdump -h $o | awk '/^ *[0-9]+ / { print $2, $3, $7 }'
+	.section .text
+	.globl a
+	.p2align 4
+a:
+	ret
+	.globl b
+	.p2align 4
+b:
+	movq $1, %rax
+	movq $2, %rcx
+	movq $3, %rdx
+	movq $4, %rsi
+	cmpq %rax, %rbx
+	je b
+	ret
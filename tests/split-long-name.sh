@@ -0,0 +1,10 @@
+# Prints a function with a 1000 character name, which -ffunction-sections
+# puts in a section whose .rela section name is longer still.
+name=f$(printf '%0999d' 0 | tr 0 x)
+echo "# as: -ffunction-sections"
+echo "# dump: readelf -W -S \$o | sed -n 's/^ *\\\\[ *[0-9]*\\\\] \\\\([^ ]*\\\\).*/\\\\1/p' | awk '{ print length(\$0), substr(\$0, 1, 16) }'"
+echo "	.section .text"
+echo "	.globl $name"
+echo "$name:"
+echo "	callq external"
+echo "	ret"
@@ -0,0 +1,30 @@
+# -ffunction-sections and -fdata-sections move each function and object
+# at a global symbol to a section of its own, with its relocations.
+# as: -ffunction-sections -fdata-sections
+# dump: objdump -d -r -w $o; objdump -h $o | awk '/^ *[0-9]+ / { n = $2 " " $3 " " $7; getline; sub(/^ */, ""); print n, $0 }'; objdump -t $o | grep " g " | sort -k6
+	.section .text
+	.globl f
+	.p2align 4
+f:
+	callq g
+	leaq .Llocal(%rip), %rax
+	ret
+.Llocal:
+	ret
+	.globl g
+	.p2align 4
+g:
+	movq x(%rip), %rax
+	ret
+	.section .data
+	.globl x
+	.p2align 3
+x:
+	.quad 1
+	.globl y
+y:
+	.long 2
+	.section .rodata
+	.globl z
+z:
+	.quad f
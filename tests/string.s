@@ -0,0 +1,35 @@
+# String instructions with repeat prefixes, on the same line or before it.
+	.section .text
+	movsb
+	movsw
+	movsl
+	movsq
+	stosb
+	stosw
+	stosl
+	stosq
+	lodsb
+	lodsw
+	lodsl
+	lodsq
+	rep movsb
+	rep stosb
+	rep movsw
+	rep stosw
+	rep movsl
+	rep stosl
+	rep movsq
+	rep stosq
+	repe cmpsb
+	repne scasb
+	repe cmpsw
+	repne scasw
+	repe cmpsl
+	repne scasl
+	repe cmpsq
+	repne scasq
+	repz cmpsb
+	repnz scasb
+	rep; movsq
+	rep
+	stosb
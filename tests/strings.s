@@ -0,0 +1,16 @@
+# dump: readelf -W -p .strtab -p .shstrtab $o | grep "\]"; readelf -W -s $o | grep -o "GLOBAL.*"; readelf -W -S $o | sed -n 's/^ *\[ *[0-9]*\] \([^ ]*\).*/\1/p'
+	.section .text.hot, "ax"
+	.globl foo_bar
+foo_bar:
+	callq bar
+	callq foo_bar
+	.globl bar
+bar:
+	callq _bar
+	ret
+	.globl _bar
+_bar:
+	ret
+	.data
+	.quad bar
+	.quad foo_bar
@@ -0,0 +1,13 @@
+# Enough labels and forward references to grow the symbol hash table
+# several times. Every call must resolve to its own label.
+n=70
+echo "	.section .text"
+i=0
+while [ $i -lt $n ]; do
+	echo "	.globl f$i"
+	echo "f$i:"
+	echo "	callq f$(( (i * 7 + 3) % n ))"
+	echo "	leaq .L$(( (i * 13 + 5) % n ))(%rip), %rax"
+	echo ".L$i:"
+	i=$((i + 1))
+done
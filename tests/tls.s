@@ -0,0 +1,25 @@
+# TLS access models, with the prefixes of the general dynamic sequence.
+	.section .text
+	.global f
+f:
+	movq %fs:0, %rax
+	movl %fs:x@tpoff, %eax
+	movq x@gottpoff(%rip), %rax
+	movl %fs:(%rax), %eax
+	movq %gs:8, %rcx
+	data16 leaq x@tlsgd(%rip), %rdi
+	.value 0x6666
+	rex64
+	callq __tls_get_addr@PLT
+	data16 leaq x@tlsgd(%rip), %rdi
+	data16 rex64 callq __tls_get_addr@PLT
+	leaq y@tlsld(%rip), %rdi
+	callq __tls_get_addr@PLT
+	movl y@dtpoff(%rax), %eax
+	ret
+	.section .tbss
+	.global x
+x:
+	.zero 4
+y:
+	.zero 4
@@ -0,0 +1,24 @@
+# dump: readelf -W -s $o | awk 'NR > 3 && $8 !~ /^\./ { print $3, $4, $5, $8 }'
+	.text
+	.globl f
+	.type f, @function
+f:
+	ret
+	.size f, . - f
+	.globl g
+	.type g, @function
+g:
+	xorl %eax, %eax
+	ret
+	.size g, .-g
+	.data
+	.globl table
+	.type table, @object
+table:
+	.quad 1
+	.quad 2
+	.size table, 16
+	.type counter, @object
+	.size counter, 4
+counter:
+	.long 0
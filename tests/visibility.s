@@ -0,0 +1,16 @@
+# dump: readelf -W -s $o | awk 'NR > 3 && $8 !~ /^\./ { print $5, $6, $7, $8 }'
+	.text
+	.globl plain
+	.globl hidden
+	.globl protected
+	.globl internal
+	.hidden hidden
+	.protected protected
+	.internal internal
+plain:
+hidden:
+protected:
+internal:
+	ret
+	.hidden undefined
+	callq undefined